@@ -31,8 +31,10 @@ u_int diskaddr(u_int blockno) {
 
 // Overview:
 //      Check if this virtual address is mapped to a block. (check PTE_V bit)
+//      A block the kernel swapped out is still mapped: touching it brings it
+//      back, with whatever changes were not yet written to disk.
 u_int va_is_mapped(u_int va) {
-        return (((*vpd)[PDX(va)] & (PTE_V)) && ((*vpt)[VPN(va)] & (PTE_V)));
+        return (((*vpd)[PDX(va)] & (PTE_V)) && ((*vpt)[VPN(va)] & (PTE_V | PTE_SWAP)));
 }
 
 // Overview:
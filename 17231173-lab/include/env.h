@@ -9,11 +9,16 @@
 #include "mmu.h"
 #include "pthread.h"
 
-#define LOG2NENV        10
+#define LOG2NENV        12
 #define NENV            (1<<LOG2NENV)
 #define TCB2ENV         16
 #define ENVX(envid)     ((envid) & (NENV - 1))
-#define GET_ENV_ASID(envid) (((envid)>> 11)<<6)
+#define LOG2ENVSZ       9       // sizeof(struct Env) is 1 << LOG2ENVSZ
+#define ENV_CHUNK       64      // envs added to the table at a time
+#define ENV_LAT_BUCKETS 8       // log2 buckets of ready-to-run latency
+
+// Flags of env_pgfault_flags
+#define PGFAULT_COW     0x1     // pass PTE_COW write faults to the user handler
 
 // Values of env_status in struct Env
 #define ENV_FREE        0
@@ -21,44 +26,85 @@
 #define ENV_NOT_RUNNABLE        2
 
 struct Env {
-        struct Trapframe env_tf;        // Saved registers
-        LIST_ENTRY(Env) env_link;       // Free list
-        u_int env_id;                   // Unique environment identifier
-        u_int env_parent_id;            // env_id of this env's parent
-        u_int env_status;               // Status of the environment
-        Pde  *env_pgdir;                // Kernel virtual address of page dir
-        u_int env_cr3;
-        LIST_ENTRY(Env) env_sched_link;
-    u_int env_pri;
-
-        // Lab 4 IPC
-        u_int env_ipc_value;            // data value sent to us
-        u_int env_ipc_from;             // envid of the sender
-        u_int env_ipc_recving;          // env is blocked receiving
-        u_int env_ipc_dstva;            // va at which to map received page
-        u_int env_ipc_perm;             // perm of page mapping received
-
-        // Lab 4 fault handling
-        u_int env_pgfault_handler;      // page fault state
-        u_int env_xstacktop;            // top of exception stack
-
-        // Lab 6 scheduler counts
-        u_int env_runs;                 // number of times been env_run'ed
-        u_int env_nop; // align to avoid mul instruction
-
-        // Challenge threads
-        struct Env *tcb_super;
-        struct Env *tcb_children[TCB2ENV];
-        u_int tcb_cnum;
-        LIST_ENTRY(Env) env_blocked_link; // for sem queue
-        void *retval;
-        int dead;
+        // The fields share a union with env_pad, so the struct is always
+        // 1 << LOG2ENVSZ bytes and envs[i] is a shift, not a mul instruction.
+        union {
+                struct {
+                        struct Trapframe env_tf;        // Saved registers
+                        LIST_ENTRY(Env) env_link;       // Free list
+                        u_int env_id;                   // Unique environment identifier
+                        u_int env_parent_id;            // env_id of this env's parent
+                        u_int env_status;               // Status of the environment
+                        Pde  *env_pgdir;                // Kernel virtual address of page dir
+                        u_int env_cr3;
+                        u_int env_asid;                 // ASID generation | ASID, see asid_alloc
+                        TAILQ_ENTRY(Env) env_sched_link; // Run queue link, queued iff ENV_RUNNABLE
+                        u_int env_pri;                  // Time slice in timer ticks
+                        u_int env_level;                // Run queue level, see sched.h
+                        u_int env_period;               // EDF period in ticks, 0 if round-robin
+                        u_int env_budget;               // EDF ticks granted per period
+                        u_int env_edf_left;             // EDF budget left in this period
+                        u_int env_deadline;             // Tick at which this period ends
+                        u_int env_edf_miss;             // Periods that ended with budget unused
+
+                        // Lab 4 IPC
+                        u_int env_ipc_value;            // data value sent to us
+                        u_int env_ipc_from;             // envid of the sender
+                        u_int env_ipc_recving;          // env is blocked receiving
+                        u_int env_ipc_dstva;            // va at which to map received page
+                        u_int env_ipc_perm;             // perm of page mapping received
+
+                        // Lab 4 fault handling
+                        u_int env_pgfault_handler;      // page fault state
+                        u_int env_xstacktop;            // top of exception stack
+                        u_int env_pgfault_flags;        // PGFAULT_* opt-ins
+
+                        // Timed waits, see timer.h
+                        LIST_ENTRY(Env) env_timer_link; // Timer wheel slot, armed iff linked
+                        u_int env_timeout;              // Tick at which the timer expires
+                        void *env_sem;                  // Kernel address of semaphore waited on; its page is pinned
+
+                        // Lab 6 scheduler counts
+                        u_int env_runs;                 // number of times been env_run'ed
+
+                        // Scheduler accounting, read-only to user space through UENVS
+                        u_int env_ticks;                // timer ticks spent running
+                        u_int env_wait_ticks;           // ticks spent runnable but not running
+                        u_int env_vswitch;              // times it blocked or yielded the CPU
+                        u_int env_ivswitch;             // times it was preempted
+                        u_int env_ready_at;             // tick at which it last became ready
+                        u_int env_lat_hist[ENV_LAT_BUCKETS]; // ready-to-run latency in ticks:
+                                                        // bucket 0 counts 0, bucket i counts
+                                                        // [2^(i-1), 2^i), the last one the rest
+
+                        // Challenge threads
+                        struct Tcb *env_tcb;            // Kernel address of the thread group, or NULL
+                        LIST_ENTRY(Env) env_blocked_link; // for sem queue
+                };
+                u_char env_pad[1 << LOG2ENVSZ];
+        };
+};
+
+/* A thread group. The kernel allocates it with the group's first thread
+ * and maps it read-only at UTCB in the address space the threads share;
+ * only the kernel writes it. Thread 0 is the leader, thread i the env
+ * tcb_children[i - 1]. How the threads exited is kept by the threads
+ * themselves, at UTCBEXIT. */
+struct Tcb {
+        u_int tcb_leader;               // env id of the leader
+        u_int tcb_cnum;                 // threads besides the leader
+        u_int tcb_children[TCB2ENV];    // their env ids
 };
 
 LIST_HEAD(Env_list, Env);
-extern struct Env *envs;                // All environments
+TAILQ_HEAD(Env_tailq, Env);
+extern struct Env *envs;                // All environments, at UENVS for user space
+extern struct Env *env_chunks[NENV / ENV_CHUNK]; // The kernel's view of them
+extern u_int env_nchunk;                // Chunks allocated so far
+
+/* The env in slot `envx` of the table; its chunk must have been allocated. */
+#define ENV_SLOT(envx)  (&env_chunks[(envx) / ENV_CHUNK][(envx) % ENV_CHUNK])
 extern struct Env *curenv;              // the current env
-extern struct Env_list env_sched_list[2]; // runnable env list
 
 void env_init(void);
 int env_alloc(struct Env **e, u_int parent_id);
@@ -70,7 +116,8 @@ void thread_destroy(struct Env *e);
 
 int envid2env(u_int envid, struct Env **penv, int checkperm);
 void env_run(struct Env *e);
-void env_libpage(u_int va);
+void env_park(void);
+void env_share_vm(struct Env *e, struct Env *src);
 
 // for the grading script
 #define ENV_CREATE2(x, y) \
@@ -12,6 +12,9 @@
 #define E_NO_FREE_ENV   5       // Attempt to create a new environment beyond
                                 // the maximum allowed
 #define E_IPC_NOT_RECV  6       // Attempt to send to env that is not recving.
+#define E_TIMEOUT       13      // A timed wait expired
+#define E_OVERLOAD      14      // A CPU reservation failed admission control
+#define E_IO            15      // The disk reported a failed transfer
 
 // File system error codes -- only seen in user-level
 #define E_NO_DISK       7       // No free space left on disk
@@ -21,7 +24,7 @@
 #define E_FILE_EXISTS   11      // File already exists
 #define E_NOT_EXEC      12      // File not a valid executable
 
-#define MAXERROR 12
+#define MAXERROR 15
 
 #endif // _ERROR_H_
 
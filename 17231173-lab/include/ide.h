@@ -0,0 +1,11 @@
+#ifndef _IDE_H_
+#define _IDE_H_
+
+#include "types.h"
+
+#define IDE_SECT        0x200   // bytes per sector
+#define IDE_MAX_NSECT   2048    // sectors per sys_ide_rw: 1 MB
+
+int ide_rw(u_int diskno, u_int secno, void *buf, u_int nsect, int write);
+
+#endif /* _IDE_H_ */
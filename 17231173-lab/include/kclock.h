@@ -3,8 +3,10 @@
 #ifndef _KCLOCK_H_
 #define _KCLOCK_H_
 #define IO_RTC          0xb5000100              /* RTC port */
+#define KCLOCK_HZ       1                       /* timer interrupts per second */
 #ifndef __ASSEMBLER__
 void kclock_init(void);
+void kclock_idle(void);
 #endif /* !__ASSEMBLER__ */
 #endif
 
@@ -27,6 +27,9 @@
 
 #define VA2PFN(va)              (((u_long)(va)) & 0xFFFFF000 ) // va 2 PFN for EntryLo0/1
 #define PTE2PT          1024
+#define NTLB            64              // entries in the R3000 TLB
+#define NASID           64              // ASIDs in the EntryHi register
+#define ASID_SHIFT      6               // position of the ASID in EntryHi
 //$#define VA2PDE(va)           (((u_long)(va)) & 0xFFC00000 ) // for context
 
 /* Page Table/Directory Entry flags
@@ -39,6 +42,7 @@
 #define PTE_COW         0x0001  // Copy On Write
 #define PTE_UC          0x0800  // unCached
 #define PTE_LIBRARY             0x0004  // share memmory
+#define PTE_SWAP        0x0008  // not valid, swapped out: the PFN field is the swap slot
 /*
  * Part 2.  Our conventions.
  */
@@ -48,7 +52,9 @@
  o                      |       ...                  |  kseg3
  o                      +----------------------------+------------0xe000 0000
  o                      |       ...                  |  kseg2
- o                      +----------------------------+------------0xc000 0000
+ o                      +----------------------------+------------0xc020 0000
+ o                      |  Linear page table (KVPT)  |  2 MB, 4 bytes per kuseg page
+ o      KVPT     -----> +----------------------------+------------0xc000 0000
  o                      |   Interrupts & Exception   |  kseg1
  o                      +----------------------------+------------0xa000 0000
  o                      |      Invalid memory        |   /|\
@@ -97,6 +103,10 @@
 #define UPAGES (UVPT - PDMAP)
 #define UENVS (UPAGES - PDMAP)
 
+// the current address space's page tables, one after the other, mapped
+// read-only on demand by the refill handler in start.S. Context's PTEBase.
+#define KVPT 0xc0000000
+
 #define UTOP UENVS
 #define UXSTACKTOP (UTOP)
 #define TIMESTACK 0x82000000
@@ -105,6 +115,8 @@
 #define UTEXT 0x00400000
 #define UTHREAD (UTEXT-BY2PG*2)
 #define USEM (UTEXT-BY2PG*3)
+#define UTCB (UTEXT-BY2PG*4)
+#define UTCBEXIT (UTEXT-BY2PG*5)
 
 
 #define E_UNSPECIFIED   1       // Unspecified or unknown problem
@@ -115,6 +127,9 @@
 #define E_NO_FREE_ENV   5       // Attempt to create a new environment beyond
                                 // the maximum allowed
 #define E_IPC_NOT_RECV  6       // Attempt to send to env that is not recving.
+#define E_TIMEOUT       13      // A timed wait expired
+#define E_OVERLOAD      14      // A CPU reservation failed admission control
+#define E_IO            15      // The disk reported a failed transfer
 
 // File system error codes -- only seen in user-level
 #define E_NO_DISK       7       // No free space left on disk
@@ -124,7 +139,7 @@
 #define E_FILE_EXISTS   11      // File already exists
 #define E_NOT_EXEC      12      // File not a valid executable
 
-#define MAXERROR 12
+#define MAXERROR 15
 
 #ifndef __ASSEMBLER__
 
@@ -175,6 +190,8 @@ extern volatile Pde* vpd[];
 
 
 extern void tlb_out(u_int entryhi);
+extern void tlb_flush(void);
+extern u_int tlb_read_lo(u_int index);
 #endif //!__ASSEMBLER__
 #endif // !_MMU_H_
 
@@ -6,6 +6,15 @@
 #include "mmu.h"
 #include "printf.h"
 
+struct Env;
+
+
+/* Buddy allocator: free blocks of 2^order pages, order 0..PAGE_MAX_ORDER. */
+#define PAGE_MAX_ORDER  10
+
+/* Pool of pre-zeroed pages for page_alloc, refilled while the CPU idles. */
+#define PAGE_ZERO_MAX   64
+#define PAGE_ZERO_BATCH 8       // pages cleared per visit to the idle path
 
 LIST_HEAD(Page_list, Page);
 typedef LIST_ENTRY(Page) Page_LIST_entry_t;
@@ -16,9 +25,30 @@ struct Page {
         // Ref is the count of pointers (usually in page table entries)
         // to this page.  This only holds for pages allocated using
         // page_alloc.  Pages allocated at boot time using pmap.c's "alloc"
-        // do not have valid reference count fields.
+        // do not have valid reference count fields. It is a full word
+        // because the zero page gets a reference for every mapping of it
+        // in every address space, which would soon wrap a u_short.
+
+        u_int pp_ref;
+
+        // Set iff this page is the first page of a free buddy block,
+        // which then spans 2^pp_order pages.
+        u_char pp_free;
+        u_char pp_order;
+
+        // Set when the page was seen in the TLB; cleared by the swap clock.
+        u_char pp_accessed;
 
-        u_short pp_ref;
+        // Address space and address of the page's last mapping; only a
+        // page mapped once, in a live address space, is swapped out.
+        Pde *pp_pgdir;
+        u_long pp_va;
+
+        // For a page directory: an env using it, see swap_victim.
+        u_int pp_envid;
+
+        // For a page table: its entries with PTE_V or PTE_SWAP set.
+        u_short pp_live;
 };
 
 extern struct Page *pages;
@@ -49,6 +79,13 @@ page2kva(struct Page *pp)
 }
 
 
+// The page table holding page table entry `pte`.
+static inline struct Page *
+pte2pt(Pte *pte)
+{
+        return pa2page(PADDR(pte));
+}
+
 static inline u_long
 va2pa(Pde *pgdir, u_long va)
 {
@@ -71,17 +108,29 @@ void mips_init();
 void page_init(void);
 void page_check();
 int page_alloc(struct Page **pp);
+int page_alloc_order(u_int order, struct Page **pp);
+int page_alloc_nozero(struct Page **pp);
+void page_zero_refill(void);
+int page_insert_zero(Pde *pgdir, u_long va);
+int page_cow_fault(Pde *pgdir, u_long va, int zero_only);
 void page_free(struct Page *pp);
 void page_decref(struct Page *pp);
 int pgdir_walk(Pde *pgdir, u_long va, int create, Pte **ppte);
 int page_insert(Pde *pgdir, struct Page *pp, u_long va, u_int perm);
 struct Page* page_lookup(Pde *pgdir, u_long va, Pte **ppte);
 void page_remove(Pde *pgdir, u_long va) ;
+void page_remove_range(Pde *pgdir, u_long va, u_int npages);
+int page_map_range(Pde *srcpgdir, u_long srcva, Pde *dstpgdir, u_long dstva, u_int npages, u_int mask);
+int page_insert_range(Pde *pgdir, u_long va, struct Page **pps, u_int npages, u_int perm);
 void tlb_invalidate(Pde *pgdir, u_long va);
+extern u_int kvpt_misses;
+u_int asid_alloc(struct Env *e);
+void asid_free(struct Env *e);
 
 void boot_map_segment(Pde *pgdir, u_long va, u_long size, u_long pa, int perm);
 
 extern struct Page *pages;
+extern struct Page *zero_page;
 
 
 #endif /* _PMAP_H_ */
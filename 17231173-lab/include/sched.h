@@ -3,9 +3,31 @@
 #ifndef __SCHED_H__
 #define __SCHED_H__
 
+#include <env.h>
+#include <unistd.h>
+
+#define SCHED_BOOST_TICKS       100     // ticks between priority boosts
+
+/* Share of the CPU, in permille, EDF reservations may claim together. */
+#define SCHED_EDF_UTIL          900
+
+/* Keep the threads of an sfork group adjacent and switch between them first. */
+#define SCHED_GANG
+
 void sched_init(void);
 void sched_yield(void);
+void sched_yield_to(struct Env *e);
 void sched_intr(int);
 
-#endif /* __SCHED_H__ */
+void sched_enqueue(struct Env *e);
+void sched_dequeue(struct Env *e);
+void sched_promote(struct Env *e);
+void sched_set_level(struct Env *e, u_int level);
+int sched_set_edf(struct Env *e, u_int period, u_int budget);
+
+extern u_int sched_idle_ticks;
+extern u_int sched_idle_count;
+extern u_int sched_switches;
+extern u_int sched_gang_switches;
 
+#endif /* __SCHED_H__ */
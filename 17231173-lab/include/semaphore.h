@@ -19,6 +19,7 @@ typedef struct {
 int sem_init(sem_t *sem, int pshared, u_int value);
 int sem_destroy(sem_t *sem);
 int sem_wait(sem_t *sem);
+int sem_timedwait(sem_t *sem, u_int ticks);
 int sem_trywait(sem_t *sem);
 int sem_post(sem_t *sem);
 int sem_getvalue(sem_t *sem, int *sval);
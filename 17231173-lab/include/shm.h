@@ -0,0 +1,29 @@
+#ifndef _SHM_H_
+#define _SHM_H_
+
+#include "types.h"
+#include "queue.h"
+#include "pmap.h"
+
+#define SHM_PRIVATE     0       // key of a segment no other shm_get finds
+#define SHM_MAX_NPAGE   4096    // pages per segment: 16 MB
+#define SHM_TOTAL_NPAGE 4096    // pages in all segments together
+
+/* A shared memory segment. It holds one reference to each of its pages,
+ * and every mapping of them holds one more, so the pages outlive the
+ * segment for as long as they stay attached somewhere. */
+struct Shm {
+        u_int shm_id;                   // never reused, so stale ids fail
+        u_int shm_key;
+        u_int shm_npage;
+        u_int shm_creator;              // env id; only it may remove the segment
+        struct Page **shm_pages;
+        LIST_ENTRY(Shm) shm_link;
+};
+
+int shm_get(u_int key, u_int size, int create, u_int envid);
+int shm_attach(u_int id, Pde *pgdir, u_int va, u_int perm);
+int shm_detach(u_int id, Pde *pgdir, u_int va);
+int shm_remove(u_int id, u_int envid);
+
+#endif /* _SHM_H_ */
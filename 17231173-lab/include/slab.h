@@ -0,0 +1,47 @@
+#ifndef _SLAB_H_
+#define _SLAB_H_
+
+#include "types.h"
+#include "queue.h"
+
+#define KMEM_ALIGN      8       // alignment of every object and colour step
+#define KMEM_MIN_SHIFT  4       // smallest kmalloc size class: 16 bytes
+#define KMEM_MAX_SHIFT  11      // largest: 2 KB; bigger requests get whole pages
+
+struct Slab;
+LIST_HEAD(Slab_list, Slab);
+
+/* A cache of objects of one size, carved out of one-page slabs. Each slab
+ * starts its objects at a different colour offset, so objects of the same
+ * index in two slabs do not all fall on the same cache lines. */
+struct kmem_cache {
+        const char *kc_name;
+        u_int kc_size;                  // object size, a multiple of KMEM_ALIGN
+        u_int kc_num;                   // objects per slab
+        u_int kc_offset;                // offset of the first object, before colouring
+        u_int kc_colour_max;            // spare bytes in a slab: the largest colour
+        u_int kc_colour_next;           // colour of the next slab
+        void (*kc_ctor)(void *);        // run on each object when its slab is made
+
+        struct Slab_list kc_full;
+        struct Slab_list kc_partial;
+        struct Slab_list kc_empty;      // at most one slab kept for reuse
+        LIST_ENTRY(kmem_cache) kc_link;
+
+        // statistics
+        u_int kc_allocs;                // objects handed out
+        u_int kc_frees;                 // objects given back
+        u_int kc_inuse;                 // objects allocated right now
+        u_int kc_slabs;                 // slabs held right now
+        u_int kc_grows;                 // slabs ever allocated
+};
+
+void kmem_init(void);
+struct kmem_cache *kmem_cache_create(const char *name, u_int size, void (*ctor)(void *));
+void *kmem_cache_alloc(struct kmem_cache *kc);
+void kmem_cache_free(struct kmem_cache *kc, void *obj);
+void *kmalloc(u_int size);
+void kfree(void *obj);
+void kmem_stat(void);
+
+#endif /* _SLAB_H_ */
@@ -0,0 +1,18 @@
+#ifndef _SWAP_H_
+#define _SWAP_H_
+
+#include "types.h"
+#include "mmu.h"
+
+#define SWAP_DISKNO     1       // gxemul disk holding swapped pages, see gxemul/r3000
+#define SWAP_NSLOT      16384   // pages of swap space: 64 MB
+#define SWAP_SAMPLE     8       // timer ticks between two samples of the TLB
+
+extern u_int swap_outs, swap_ins;
+
+int swap_out(void);
+int swap_in(Pde *pgdir, u_long va, Pte *pte);
+void swap_free(Pte pte);
+void swap_sample(void);
+
+#endif /* _SWAP_H_ */
@@ -0,0 +1,25 @@
+/* See COPYRIGHT for copyright information. */
+
+#ifndef _TIMER_H_
+#define _TIMER_H_
+
+#include <env.h>
+
+/* Two-level timer wheel: TVR_SIZE one-tick slots, then TVN_SIZE slots
+ * of TVR_SIZE ticks each. Timers further out are parked in the last
+ * slot and cascaded again when it comes around. */
+#define TVR_BITS        8
+#define TVN_BITS        6
+#define TVR_SIZE        (1 << TVR_BITS)
+#define TVN_SIZE        (1 << TVN_BITS)
+#define TVR_MASK        (TVR_SIZE - 1)
+#define TVN_MASK        (TVN_SIZE - 1)
+
+extern u_int timer_jiffies;     // next tick the wheel will process
+
+void timer_init(void);
+void timer_add(struct Env *e, u_int ticks);
+void timer_cancel(struct Env *e);
+void timer_advance(u_int ticks);
+
+#endif /* _TIMER_H_ */
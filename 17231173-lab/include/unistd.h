@@ -28,6 +28,31 @@
 #define SYS_sem_trywait                 ((__SYSCALL_BASE ) + (20))
 #define SYS_sem_post                    ((__SYSCALL_BASE ) + (21))
 #define SYS_sem_getvalue                ((__SYSCALL_BASE ) + (22))
+#define SYS_yield_to                    ((__SYSCALL_BASE ) + (23))
+#define SYS_sleep                       ((__SYSCALL_BASE ) + (24))
+#define SYS_sem_timedwait               ((__SYSCALL_BASE ) + (25))
+#define SYS_ipc_recv_timeout            ((__SYSCALL_BASE ) + (26))
+#define SYS_set_priority                ((__SYSCALL_BASE ) + (27))
+#define SYS_set_edf                     ((__SYSCALL_BASE ) + (28))
+#define SYS_mem_alloc_range             ((__SYSCALL_BASE ) + (29))
+#define SYS_fork                        ((__SYSCALL_BASE ) + (30))
+#define SYS_mem_map_range               ((__SYSCALL_BASE ) + (31))
+#define SYS_mem_unmap_range             ((__SYSCALL_BASE ) + (32))
+#define SYS_thread_alloc                ((__SYSCALL_BASE ) + (33))
+#define SYS_shm_get                     ((__SYSCALL_BASE ) + (34))
+#define SYS_shm_attach                  ((__SYSCALL_BASE ) + (35))
+#define SYS_shm_detach                  ((__SYSCALL_BASE ) + (36))
+#define SYS_shm_remove                  ((__SYSCALL_BASE ) + (37))
+#define SYS_ide_rw                      ((__SYSCALL_BASE ) + (38))
+#define SYS_kmem_stat                   ((__SYSCALL_BASE ) + (39))
+
+/* Run queue levels, as taken by SYS_set_priority: 0 is the highest. */
+#define SCHED_NPRI              32
+#define SCHED_PRI_DEFAULT       (SCHED_NPRI / 2)
+
+/* Levels the multi-level feedback policy may move an env between. */
+#define SCHED_MLFQ_TOP          (SCHED_PRI_DEFAULT - 4)
+#define SCHED_MLFQ_BOTTOM       (SCHED_PRI_DEFAULT + 3)
 
 #endif
 
@@ -1,10 +1,18 @@
 #include <asm/asm.h>
 #include <pmap.h>
+#include <slab.h>
 #include <env.h>
 #include <printf.h>
 #include <kclock.h>
 #include <trap.h>
 
+/* The program to start, set by init/Makefile from `make test=<name>`. */
+#ifndef TEST_ENV
+#define TEST_ENV user_testsem
+#endif
+// ENV_CREATE pastes its argument, so TEST_ENV must be expanded first
+#define ENV_CREATE_TEST(x) ENV_CREATE(x)
+
 extern char aoutcode[];
 extern char boutcode[];
 
@@ -15,12 +23,12 @@ void mips_init() {
         mips_vm_init();
         page_init();
         //page_check();
+        kmem_init();
 
         env_init();
 
         //ENV_CREATE(user_fktest);
         //ENV_CREATE(user_pt1);
-        //ENV_CREATE(user_idle);
         //ENV_CREATE(user_testpipe);
         //ENV_CREATE(user_testpiperace);
         //ENV_CREATE(user_testptelibrary);
@@ -30,7 +38,7 @@ void mips_init() {
         //ENV_CREATE(user_pingpong);
         //ENV_CREATE(user_testfdsharing);
         //ENV_CREATE(user_testspawn);
-        ENV_CREATE(user_testsem);
+        ENV_CREATE_TEST(TEST_ENV);
         trap_init();
         kclock_init();
         //env_run(&envs[0]);
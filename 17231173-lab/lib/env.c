@@ -6,14 +6,21 @@
 #include <env.h>
 #include <kerelf.h>
 #include <sched.h>
+#include <timer.h>
 #include <pmap.h>
+#include <swap.h>
+#include <semaphore.h>
 #include <printf.h>
 
-struct Env *envs = NULL;                // All environments
+struct Env *env_chunks[NENV / ENV_CHUNK]; // All environments, ENV_CHUNK at a time
+u_int env_nchunk = 0;
 struct Env *curenv = NULL;              // the current env
 
+/* chunks fill whole pages of UENVS, and indexing them takes a shift;
+ * fails once the fields outgrow env_pad */
+typedef char env_size_check[sizeof(struct Env) == (1 << LOG2ENVSZ) ? 1 : -1];
+
 static struct Env_list env_free_list;   // Free list
-struct Env_list env_sched_list[2];      // Runnable list
 
 extern Pde *boot_pgdir;
 extern char *KERNEL_SP;
@@ -30,7 +37,7 @@ extern char *KERNEL_SP;
  */
 u_int mkenvid(struct Env *e) {
         static u_long next_env_id = 0;
-        u_int idx = e - envs;
+        u_int idx = ENVX(e->env_id);
 #ifdef DEBUG
         u_int result = (++next_env_id << (1 + LOG2NENV)) | idx;
         printf("mkenvid@env.c: generated env id %x for env %x\n", result, e);
@@ -38,7 +45,8 @@ u_int mkenvid(struct Env *e) {
 #endif
         return (++next_env_id << (1 + LOG2NENV)) | idx;
 }
-/*Hint: lower bits of envid hold e's position in the envs array. */
+/*Hint: lower bits of envid hold e's position in the envs array; a free
+ * env's id keeps them too. */
 /*Hint:  high bits of envid hold an increasing number. */
 
 /* Overview:
@@ -59,7 +67,11 @@ int envid2env(u_int envid, struct Env **penv, int checkperm) {
         }
 
         struct Env *e;
-        e = envs + ENVX(envid);
+        if (ENVX(envid) >= env_nchunk * ENV_CHUNK) {
+                *penv = 0;
+                return -E_BAD_ENV;
+        }
+        e = ENV_SLOT(ENVX(envid));
 
         if (e->env_status == ENV_FREE || e->env_id != envid) {
                 *penv = 0;
@@ -85,8 +97,55 @@ int envid2env(u_int envid, struct Env **penv, int checkperm) {
 /*Step 2: Make a check according to checkperm. */
 
 /* Overview:
- *  Mark all environments in 'envs' as free and insert them into the env_free_list.
- *  Insert in reverse order,so that the first call to env_alloc() return envs[0].
+ *  Append `chunk` to the table: mark its envs as free and insert them into
+ *  the env_free_list, in reverse order so that they are handed out in order.
+ */
+static void env_chunk_add(struct Env *chunk) {
+        int i;
+
+        env_chunks[env_nchunk] = chunk;
+        for (i = ENV_CHUNK - 1; i >= 0; i--) {
+                chunk[i].env_status = ENV_FREE;
+                chunk[i].env_id = env_nchunk * ENV_CHUNK + i;
+                LIST_INSERT_HEAD(&env_free_list, chunk + i, env_link);
+        }
+        env_nchunk++;
+}
+
+/* Overview:
+ *  Grow the table by one chunk, mapped right behind the others in UENVS.
+ *  All address spaces share boot_pgdir's page table for UENVS, so they
+ *  all see the new chunk at once.
+ *
+ * Post-Condition:
+ *  return 0 on success, -E_NO_FREE_ENV if the table is at NENV or no
+ *  memory is left.
+ */
+static int env_grow(void) {
+        struct Page *pp;
+        Pte *pte;
+        u_int order, va, i;
+
+        if (env_nchunk == NENV / ENV_CHUNK) {
+                return -E_NO_FREE_ENV;
+        }
+        for (order = 0; (BY2PG << order) < ENV_CHUNK * sizeof(struct Env); order++);
+        if (page_alloc_order(order, &pp) < 0) {
+                return -E_NO_FREE_ENV;
+        }
+        va = UENVS + env_nchunk * ENV_CHUNK * sizeof(struct Env);
+        for (i = 0; i < (1 << order); i++) {
+                pp[i].pp_ref++;
+                pgdir_walk(boot_pgdir, va + i * BY2PG, 0, &pte);
+                *pte = page2pa(pp + i) | PTE_R | PTE_V;
+        }
+        env_chunk_add((struct Env *)page2kva(pp));
+        return 0;
+}
+
+/* Overview:
+ *  Mark all environments in the first chunk of 'envs' as free and insert
+ *  them into the env_free_list. The first call to env_alloc() returns envs[0].
  *
  * Hints:
  *  You may use these defines to make it:
@@ -94,15 +153,13 @@ int envid2env(u_int envid, struct Env **penv, int checkperm) {
  */
 void env_init(void) {
         LIST_INIT(&env_free_list);
+        sched_init();
+        timer_init();
 #ifdef DEBUG
         printf("env_init@env.c: list init env_free_list succeeded\n");
 #endif
 
-        int i;
-        for (i = NENV-1; i >= 0; i--) {
-                envs[i].env_status = ENV_FREE;
-                LIST_INSERT_HEAD(&env_free_list, envs+i, env_link);
-        }
+        env_chunk_add(env_chunks[0]);
 #ifdef DEBUG
         printf("env_init@env.c: env init succeeded\n");
 #endif
@@ -187,23 +244,32 @@ int env_alloc(struct Env **new, u_int parent_id) {
         struct Env *e;
 
         *new = 0;
-        if (LIST_EMPTY(&env_free_list)) {
+        if (LIST_EMPTY(&env_free_list) && env_grow() < 0) {
                 return -E_NO_FREE_ENV;
         }
 
         e = LIST_FIRST(&env_free_list);
         env_setup_vm(e);
         e->env_id = mkenvid(e);
+        pa2page(e->env_cr3)->pp_envid = e->env_id;
         e->env_parent_id = parent_id;
-        e->env_status = ENV_RUNNABLE;
+        e->env_status = ENV_NOT_RUNNABLE;
+        e->env_level = SCHED_PRI_DEFAULT;
+        e->env_period = 0;
+        e->env_pgfault_flags = 0;
+        e->env_asid = 0;
+        e->env_edf_miss = 0;
 
         e->env_tf.regs[29] = USTACKTOP;
         e->env_tf.cp0_status = 0x10001004;
 
-        e->tcb_super = NULL;
-        e->tcb_cnum = 0;
-        e->retval = NULL;
-        e->dead = 0;
+        e->env_tcb = NULL;
+        e->env_sem = NULL;
+        e->env_ticks = 0;
+        e->env_wait_ticks = 0;
+        e->env_vswitch = 0;
+        e->env_ivswitch = 0;
+        bzero(e->env_lat_hist, sizeof(e->env_lat_hist));
 
         LIST_REMOVE(e, env_link);
 
@@ -245,30 +311,33 @@ static int load_icode_mapper(u_long va, u_int32_t sgsize, u_char *bin, u_int32_t
         struct Env *env = (struct Env *)user_data;
         struct Page *p = NULL;
         u_long i = 0;
+        u_long n;
         int r;
         u_long offset = va - ROUNDDOWN(va, BY2PG);
 
         Pde *pgdir = env->env_pgdir;
 
+        /* file pages are overwritten here, so only the gaps need clearing;
+         * bzero stores words, so clear from a word boundary before copying */
         for (i = 0; i < bin_size; i += BY2PG) {
-                if ((r = page_alloc(&p))) return r;
+                if ((r = page_alloc_nozero(&p))) return r;
                 if (i == 0) {
-                        bcopy((void *)bin,
-                                        (void *)page2kva(p)+offset,
-                                        (BY2PG - offset < bin_size) ? (BY2PG - offset) : bin_size);
+                        n = (BY2PG - offset < bin_size) ? (BY2PG - offset) : bin_size;
+                        bzero((void *)page2kva(p), offset);
+                        bzero((void *)page2kva(p)+ROUNDDOWN(offset+n, 4), BY2PG - ROUNDDOWN(offset+n, 4));
+                        bcopy((void *)bin, (void *)page2kva(p)+offset, n);
                         i = -offset;
                 } else {
-                        bcopy((void *)bin + i,
-                                        (void *)page2kva(p),
-                                        (BY2PG < bin_size - i) ? BY2PG : (bin_size - i));
+                        n = (BY2PG < bin_size - i) ? BY2PG : (bin_size - i);
+                        bzero((void *)page2kva(p)+ROUNDDOWN(n, 4), BY2PG - ROUNDDOWN(n, 4));
+                        bcopy((void *)bin + i, (void *)page2kva(p), n);
                 }
                 if ((r = page_insert(pgdir, p, va + i, PTE_R))) return r;
         }
 
+        /* bss shares the zero page until it is written */
         for (; i < sgsize; i += BY2PG) {
-                if ((r = page_alloc(&p))) return r;
-                if ((r = page_insert(pgdir, p, va+i, PTE_R))) return r;
-                bzero((void *)page2kva(p), BY2PG);
+                if ((r = page_insert_zero(pgdir, va+i))) return r;
         }
         return 0;
 }
@@ -330,7 +399,8 @@ void env_create_priority(u_char *binary, int size, int priority) {
         if (env_alloc(&e, 0)) return;
         e->env_pri = priority;
         load_icode(e, binary, size);
-        LIST_INSERT_HEAD(env_sched_list, e, env_sched_link);
+        e->env_status = ENV_RUNNABLE;
+        sched_enqueue(e);
 }
 /*Step 1: Use env_alloc to alloc a new env. */
 /*Step 2: assign priority to the new env. */
@@ -347,42 +417,60 @@ void env_create(u_char *binary, int size) {
 }
 /*Step 1: Use env_create_priority to alloc a new env with priority 1 */
 
-static void mem_map(struct Env *dstenv, u_int va) {
-
-        Pte *ppte = NULL;
-        struct Page *ppage = page_lookup(curenv->env_pgdir, va, &ppte);
-        u_int perm = PTE_V|PTE_R|PTE_LIBRARY;
-        if (page_insert(dstenv->env_pgdir, ppage, va, perm)) {
-                panic("mem_map@env.c: page_insert failed\n");
-        }
+/* Overview:
+ *  Make `e` a thread of the group of `src`: drop the page directory
+ *  env_alloc gave it and share the one of `src` instead. The page
+ *  directory counts its users in pp_ref and is torn down by the last
+ *  env_free.
+ */
+void env_share_vm(struct Env *e, struct Env *src) {
+        page_decref(pa2page(e->env_cr3));
+        e->env_pgdir = src->env_pgdir;
+        e->env_cr3 = src->env_cr3;
+        pa2page(e->env_cr3)->pp_ref++;
 }
 
-void env_libpage(u_int va) {
-        if (curenv->tcb_super == NULL && curenv->tcb_cnum == 0) {
+/* Overview:
+ *  Threads of a group share everything below UTOP, UTHREAD included, so
+ *  point the UTHREAD slot at `e` before it runs. Nothing is done for an
+ *  env with an address space of its own.
+ */
+static void env_set_uthread(struct Env *e) {
+        struct Page *pp;
+        struct Env **slot;
+        Pte *pte;
+
+        if (pa2page(e->env_cr3)->pp_ref == 1) {
                 return;
         }
-        struct Env *e;
-        int i;
-        if (curenv->tcb_super == NULL) {
-                e = curenv;
-        } else {
-                e = curenv->tcb_super;
+        if ((pp = page_lookup(e->env_pgdir, UTHREAD, &pte)) == NULL) {
+                return;
         }
-        mem_map(e, va);
-        for (i = 0; i < e->tcb_cnum; i++) {
-                mem_map(e->tcb_children[i], va);
+        if (*pte & PTE_COW) {
+                // the slot is written through kseg0, so it must not be shared
+                if (page_cow_fault(e->env_pgdir, UTHREAD, 0) <= 0) {
+                        return;
+                }
+                pp = page_lookup(e->env_pgdir, UTHREAD, &pte);
         }
+        slot = (struct Env **)page2kva(pp);
+        *slot = (struct Env *)UENVS + ENVX(e->env_id);
 }
 
 /* Overview:
- *  Frees env e and all memory it uses.
+ *  Free the user portion of the address space of e, its page tables and
+ *  its page directory.
+ *
+ * Hint:
+ *  Each page table counts its live entries in pp_live, so empty tables
+ *  are skipped and a scan stops at the last live entry. No TLB entry is
+ *  invalidated: asid_free retires the ASID, which no TLB entry, KVPT's
+ *  included, can match again before the next generation flushes everything.
  */
-void env_free(struct Env *e) {
+static void env_free_vm(struct Env *e) {
         Pte *pt;
-        u_int pdeno, pteno, pa;
-
-        /* Hint: Note the environment's demise.*/
-        printf("[%08x] free env %08x\n", curenv ? curenv->env_id : 0, e->env_id);
+        struct Page *ptp;
+        u_int pdeno, pteno, pa, live;
 
         /* Hint: Flush all mapped pages in the user portion of the address space */
         for (pdeno = 0; pdeno < PDX(UTOP); pdeno++) {
@@ -393,24 +481,95 @@ void env_free(struct Env *e) {
                 /* Hint: find the pa and va of the page table. */
                 pa = PTE_ADDR(e->env_pgdir[pdeno]);
                 pt = (Pte *)KADDR(pa);
-                /* Hint: Unmap all PTEs in this page table. */
-                for (pteno = 0; pteno <= PTX(~0); pteno++)
+                ptp = pa2page(pa);
+                /* Hint: drop all pages of the table; the entries themselves
+                 *  go away with it. */
+                for (pteno = 0, live = ptp->pp_live; live > 0; pteno++) {
                         if (pt[pteno] & PTE_V) {
-                                page_remove(e->env_pgdir, (pdeno << PDSHIFT) | (pteno << PGSHIFT));
+                                page_decref(pa2page(pt[pteno]));
+                        } else if (pt[pteno] & PTE_SWAP) {
+                                swap_free(pt[pteno]);
+                        } else {
+                                continue;
                         }
+                        live--;
+                }
                 /* Hint: free the page table itself. */
                 e->env_pgdir[pdeno] = 0;
-                page_decref(pa2page(pa));
+                page_decref(ptp);
         }
         /* Hint: free the page directory. */
         pa = e->env_cr3;
+        asid_free(e);
         e->env_pgdir = 0;
         e->env_cr3 = 0;
         page_decref(pa2page(pa));
+}
+
+/* Overview:
+ *  `e` leaves its thread group, whose address space lives on. If the page
+ *  directory names `e` as the env using it, which swap_victim checks,
+ *  name another thread of the group instead.
+ */
+static void env_leave_vm(struct Env *e) {
+        struct Page *pd = pa2page(e->env_cr3);
+        struct Tcb *tcb = e->env_tcb;
+        struct Env *t;
+        u_int id;
+        int i;
+
+        if (pd->pp_envid != e->env_id) {
+                return;
+        }
+        pd->pp_envid = 0;
+        for (i = -1; tcb != NULL && i < (int)tcb->tcb_cnum && i < TCB2ENV; i++) {
+                id = i < 0 ? tcb->tcb_leader : tcb->tcb_children[i];
+                if (id != 0 && id != e->env_id && envid2env(id, &t, 0) == 0
+                                && t->env_pgdir == e->env_pgdir) {
+                        pd->pp_envid = id;
+                        return;
+                }
+        }
+}
+
+/* Overview:
+ *  Frees env e and all memory it uses.
+ */
+void env_free(struct Env *e) {
+        u_int pa;
+
+        /* Hint: Note the environment's demise.*/
+        printf("[%08x] free env %08x\n", curenv ? curenv->env_id : 0, e->env_id);
+
+        /* Hint: leave the semaphore it waits on, and unpin its page. */
+        if (e->env_sem != NULL) {
+                LIST_REMOVE(e, env_blocked_link);
+                ((sem_t *)e->env_sem)->count++;
+                page_decref(pa2page(PADDR(e->env_sem)));
+                e->env_sem = NULL;
+        }
+
+        /* Hint: a thread leaves the address space to the rest of its group;
+         *  the last one out frees it and the group's Tcb. */
+        if (pa2page(e->env_cr3)->pp_ref > 1) {
+                env_leave_vm(e);
+                pa = e->env_cr3;
+                e->env_pgdir = 0;
+                e->env_cr3 = 0;
+                page_decref(pa2page(pa));
+        } else {
+                if (e->env_tcb != NULL) {
+                        page_decref(pa2page(PADDR(e->env_tcb)));
+                }
+                env_free_vm(e);
+        }
+        e->env_tcb = NULL;
         /* Hint: return the environment to the free list. */
+        sched_dequeue(e);
+        sched_set_edf(e, 0, 0);
+        timer_cancel(e);
         e->env_status = ENV_FREE;
         LIST_INSERT_HEAD(&env_free_list, e, env_link);
-        LIST_REMOVE(e, env_sched_link);
 }
 
 /* Overview:
@@ -418,15 +577,19 @@ void env_free(struct Env *e) {
  *  if e is the current env.
  */
 void env_destroy(struct Env *e) {
+        struct Tcb *tcb = e->env_tcb;
+        struct Env *child;
         int i;
-        if (e->tcb_super != NULL) {
+
+        if (tcb != NULL && tcb->tcb_leader != e->env_id) {
                 panic("env_destroy@env.c: target is not process\n");
         }
-        /* Hint: free e. */
-        struct Env *child;
-        for (i = 0; i < e->tcb_cnum; i++) {
-                envid2env(e->tcb_children[i]->env_id, &child, 0);
-                env_free(child);
+        /* Hint: free e, and its threads. */
+        for (i = 0; tcb != NULL && i < tcb->tcb_cnum && i < TCB2ENV; i++) {
+                if (tcb->tcb_children[i] != 0 && envid2env(tcb->tcb_children[i], &child, 0) == 0
+                                && child != e && child->env_tcb == tcb) {
+                        env_free(child);
+                }
         }
         env_free(e);
 
@@ -440,6 +603,18 @@ void env_destroy(struct Env *e) {
         }
 }
 
+/* Overview:
+ *  Save the register state of curenv and leave no env running, so that
+ *  the kernel can idle without losing it.
+ */
+void env_park(void) {
+        if (curenv) {
+                curenv->env_tf = *((struct Trapframe *)TIMESTACK-1);
+                curenv->env_tf.pc = curenv->env_tf.cp0_epc;
+        }
+        curenv = NULL;
+}
+
 extern void env_pop_tf(struct Trapframe *tf, int id);
 extern void lcontext(u_int contxt);
 
@@ -462,7 +637,8 @@ void env_run(struct Env *e) {
         curenv = e;
         curenv->env_runs++;
         lcontext((u_long)curenv->env_pgdir);
-        env_pop_tf(&(curenv->env_tf), GET_ENV_ASID(curenv->env_id));
+        env_set_uthread(curenv);
+        env_pop_tf(&(curenv->env_tf), asid_alloc(curenv));
 }
 /*Step 1: save register state of curenv. */
 /* Hint: if there is a environment running,you should do
@@ -473,7 +649,8 @@ void env_run(struct Env *e) {
  * environment   registers and drop into user mode in the
  * the   environment.
  */
-/* Hint: You should use GET_ENV_ASID there.Think why? */
+/* Hint: env_pop_tf loads the ASID into EntryHi; asid_alloc hands out a
+ *  fresh one only when the env's is from an older generation. */
 
 void env_check()
 {
@@ -492,24 +669,27 @@ void env_check()
         assert(pe1 && pe1 != pe0);
         assert(pe2 && pe2 != pe1 && pe2 != pe0);
 
-        // temporarily steal the rest of the free envs
+        // temporarily steal the rest of the free envs, and room to grow
         fl = env_free_list;
+        re = env_nchunk;
         // now this env_free list must be empty!!!!
         LIST_INIT(&env_free_list);
+        env_nchunk = NENV / ENV_CHUNK;
 
         // should be no free memory
         assert(env_alloc(&pe, 0) == -E_NO_FREE_ENV);
 
         // recover env_free_list
         env_free_list = fl;
+        env_nchunk = re;
 
         printf("pe0->env_id %d\n",pe0->env_id);
         printf("pe1->env_id %d\n",pe1->env_id);
         printf("pe2->env_id %d\n",pe2->env_id);
 
-        assert(pe0->env_id == 2048);
-        assert(pe1->env_id == 4097);
-        assert(pe2->env_id == 6146);
+        assert(pe0->env_id == 8192);
+        assert(pe1->env_id == 16385);
+        assert(pe2->env_id == 24578);
         printf("env_init() work well!\n");
 
         /* check envid2env work well */
@@ -0,0 +1,50 @@
+/*
+ * The gxemul IDE controller, driven from the kernel.
+ *
+ * The controller moves one sector per command through its 512 byte
+ * buffer, and a command is complete as soon as the start register is
+ * written: the status register can be read straight away. There is no
+ * DMA engine and no interrupt, so a transfer is a loop of commands with
+ * the data copied through kseg1.
+ */
+
+#include "mmu.h"
+#include "ide.h"
+#include "error.h"
+
+#define IDE_BASE        0xB3000000      // gxemul disk controller, through kseg1
+#define IDE_OFFSET      0x0000
+#define IDE_ID          0x0010
+#define IDE_START       0x0020
+#define IDE_STATUS      0x0030
+#define IDE_BUFFER      0x4000
+
+#define IDE_REG(off, type)      (*(volatile type *)(IDE_BASE + (off)))
+
+/* Overview:
+ *      Read `nsect` sectors of disk `diskno` from sector `secno` on into
+ * the kernel address `buf`, or write them from there if `write` is set.
+ *
+ * Post-Condition:
+ *      Return 0 on success, -E_IO if the disk failed a sector; the sectors
+ *      before it have been transferred.
+ */
+int ide_rw(u_int diskno, u_int secno, void *buf, u_int nsect, int write) {
+        u_int i;
+
+        for (i = 0; i < nsect; i++, buf += IDE_SECT) {
+                if (write) {
+                        bcopy(buf, (void *)(IDE_BASE + IDE_BUFFER), IDE_SECT);
+                }
+                IDE_REG(IDE_ID, u_int) = diskno;
+                IDE_REG(IDE_OFFSET, u_int) = (secno + i) * IDE_SECT;
+                IDE_REG(IDE_START, u_char) = write;
+                if (IDE_REG(IDE_STATUS, u_int) == 0) {
+                        return -E_IO;
+                }
+                if (!write) {
+                        bcopy((void *)(IDE_BASE + IDE_BUFFER), buf, IDE_SECT);
+                }
+        }
+        return 0;
+}
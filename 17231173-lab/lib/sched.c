@@ -1,65 +1,566 @@
 #include <env.h>
 #include <pmap.h>
 #include <printf.h>
+#include <sched.h>
+#include <kclock.h>
+#include <timer.h>
+#include <swap.h>
+
+static struct Env_tailq env_run_queue[SCHED_NPRI];     /* one FIFO per level */
+static u_int env_run_bitmap;    /* bit i set iff env_run_queue[i] is not empty */
+static u_int sched_ticks = 0;   /* timer ticks since boot */
+
+static struct Env_tailq edf_queue;      /* EDF envs with budget, by deadline */
+static struct Env_tailq edf_throttled;  /* EDF envs waiting for their next period */
+static u_int edf_util = 0;              /* admitted EDF utilization, permille */
+
+u_int sched_switches = 0;       /* env switches made by the scheduler */
+u_int sched_gang_switches = 0;  /* switches that stayed inside a thread group */
+
+/* Overview:
+ *  Return the index of the lowest set bit of a non-zero `x`, which is the
+ *  highest non-empty level when `x` is `env_run_bitmap`. R3000 has no clz,
+ *  so binary search in five fixed steps.
+ */
+static inline int sched_ffs(u_int x) {
+        int n = 0;
+        if ((x & 0x0000ffff) == 0) { n += 16; x >>= 16; }
+        if ((x & 0x000000ff) == 0) { n += 8; x >>= 8; }
+        if ((x & 0x0000000f) == 0) { n += 4; x >>= 4; }
+        if ((x & 0x00000003) == 0) { n += 2; x >>= 2; }
+        if ((x & 0x00000001) == 0) { n += 1; }
+        return n;
+}
+
+#ifdef SCHED_GANG
+/* Overview:
+ *  Env `envid` if it is a live member of thread group `tcb`, or NULL.
+ *  The Tcb page is mapped in user space, so its ids are checked before
+ *  they are followed.
+ */
+static struct Env *sched_gang_env(struct Tcb *tcb, u_int envid) {
+        struct Env *e;
+
+        if (envid == 0 || envid2env(envid, &e, 0) < 0 || e->env_tcb != tcb) {
+                return NULL;
+        }
+        return e;
+}
+
+/* Overview:
+ *  Leader of the thread group `e` belongs to, or `e` itself.
+ */
+static struct Env *sched_gang_leader(struct Env *e) {
+        struct Env *leader;
+
+        if (e->env_tcb == NULL || (leader = sched_gang_env(e->env_tcb, e->env_tcb->tcb_leader)) == NULL) {
+                return e;
+        }
+        return leader;
+}
+
+/* Overview:
+ *  Number of members of the group led by `leader`, besides the leader.
+ */
+static inline int sched_gang_cnum(struct Env *leader) {
+        if (leader->env_tcb == NULL) {
+                return 0;
+        }
+        return MIN(leader->env_tcb->tcb_cnum, TCB2ENV);
+}
+
+static inline int sched_gang_same(struct Env *a, struct Env *b) {
+        return sched_gang_leader(a) == sched_gang_leader(b);
+}
+
+/* Overview:
+ *  Member `i` of the group led by `leader`, or NULL if it is gone; member
+ *  -1 is the leader.
+ */
+static inline struct Env *sched_gang_member(struct Env *leader, int i) {
+        return i < 0 ? leader : sched_gang_env(leader->env_tcb, leader->env_tcb->tcb_children[i]);
+}
+
+/* Overview:
+ *  Return a member of `e`'s thread group, other than `e`, that is queued
+ *  on `e`'s level, or NULL if there is none.
+ */
+static struct Env *sched_gang_sibling(struct Env *e) {
+        struct Env *leader = sched_gang_leader(e);
+        struct Env *s;
+        int i;
+
+        for (i = -1; i < sched_gang_cnum(leader); i++) {
+                s = sched_gang_member(leader, i);
+                if (s != NULL && s != e && s->env_sched_link.tqe_prev != NULL && s->env_period == 0
+                                && s->env_level == e->env_level) {
+                        return s;
+                }
+        }
+        return NULL;
+}
+
+/* Overview:
+ *  Number of members of `e`'s thread group queued on `e`'s level.
+ */
+static int sched_gang_size(struct Env *e) {
+        struct Env *leader = sched_gang_leader(e);
+        struct Env *s;
+        int i, n = 0;
+
+        for (i = -1; i < sched_gang_cnum(leader); i++) {
+                s = sched_gang_member(leader, i);
+                if (s != NULL && s->env_sched_link.tqe_prev != NULL && s->env_period == 0
+                                && s->env_level == e->env_level) {
+                        n++;
+                }
+        }
+        return n;
+}
+#endif
+
+/* Overview:
+ *  Initialize every level of the run queue to be empty.
+ */
+void sched_init(void) {
+        int i;
+        for (i = 0; i < SCHED_NPRI; i++) {
+                TAILQ_INIT(env_run_queue + i);
+        }
+        env_run_bitmap = 0;
+        TAILQ_INIT(&edf_queue);
+        TAILQ_INIT(&edf_throttled);
+}
+
+/* Overview:
+ *  Queue an EDF env: by deadline on `edf_queue` while it has budget, on
+ *  `edf_throttled` once it is used up. An env whose period has ended is
+ *  replenished first; one that slept through whole periods starts a
+ *  fresh period now.
+ */
+static void sched_edf_insert(struct Env *e) {
+        struct Env *s;
+
+        if ((int)(e->env_deadline - sched_ticks) <= 0) {
+                e->env_deadline += e->env_period;
+                if ((int)(e->env_deadline - sched_ticks) <= 0) {
+                        e->env_deadline = sched_ticks + e->env_period;
+                }
+                e->env_edf_left = e->env_budget;
+        }
+        if (e->env_edf_left == 0) {
+                TAILQ_INSERT_TAIL(&edf_throttled, e, env_sched_link);
+                return;
+        }
+        TAILQ_FOREACH(s, &edf_queue, env_sched_link) {
+                if ((int)(s->env_deadline - e->env_deadline) > 0) {
+                        TAILQ_INSERT_BEFORE(s, e, env_sched_link);
+                        return;
+                }
+        }
+        TAILQ_INSERT_TAIL(&edf_queue, e, env_sched_link);
+}
 
 /* Overview:
- *  Implement simple round-robin scheduling.
- *  Search through 'envs' for a runnable environment ,
- *  in circular fashion statrting after the previously running env,
- *  and switch to the first such environment found.
+ *  Append `e` to the tail of its level. Every transition to ENV_RUNNABLE
+ *  must go through here. With SCHED_GANG, a thread joins its group
+ *  instead, so the members of a group stay adjacent on every level.
  *
- * Hints:
- *  The variable which is for counting should be defined as 'static'.
+ * Post-Condition:
+ *  `e` is on the run queue exactly once; calling this on an env that is
+ *  already queued does nothing.
  */
-void sched_yield(void) {
-#ifdef DEBUG
-        printf("sched_yield@sched.c called\n");
+void sched_enqueue(struct Env *e) {
+#ifdef SCHED_GANG
+        struct Env *s;
 #endif
-        static int pos = 0; /* current queue index */
-        static int times = 0; /* remaining times to exec */
-        static struct Env *e = NULL;
-        if (e != NULL && e->env_status != ENV_RUNNABLE) {
-#ifdef DEBUG
-                printf("sched_yield@sched.c: deleting not runnable env %d from env_sched_list\n", e-envs);
+
+        if (e->env_sched_link.tqe_prev != NULL) {
+                return;
+        }
+        if (e->env_level >= SCHED_NPRI) {
+                e->env_level = SCHED_NPRI - 1;
+        }
+        e->env_ready_at = sched_ticks;
+        if (e->env_period != 0) {
+                sched_edf_insert(e);
+                return;
+        }
+#ifdef SCHED_GANG
+        if ((s = sched_gang_sibling(e)) != NULL) {
+                TAILQ_INSERT_AFTER(env_run_queue + e->env_level, s, e, env_sched_link);
+                return;
+        }
 #endif
-                LIST_REMOVE(e, env_sched_link);
-                e = NULL;
-                times = 0;
+        TAILQ_INSERT_TAIL(env_run_queue + e->env_level, e, env_sched_link);
+        env_run_bitmap |= 1 << e->env_level;
+}
+
+/* Overview:
+ *  Remove `e` from the run queue. Every transition away from ENV_RUNNABLE
+ *  must go through here. Calling this on an env that is not queued does
+ *  nothing.
+ */
+void sched_dequeue(struct Env *e) {
+        struct Env_tailq *q;
+
+        if (e->env_sched_link.tqe_prev == NULL) {
+                return;
         }
-        if (times == 0) { // time is up
-#ifdef DEBUG
-                if (e != NULL) {
-                        printf("sched_yield@sched.c: time up for current env %d\n", e-envs);
+        if (e->env_period != 0) {
+                q = e->env_edf_left ? &edf_queue : &edf_throttled;
+        } else {
+                q = env_run_queue + e->env_level;
+        }
+        TAILQ_REMOVE(q, e, env_sched_link);
+        e->env_sched_link.tqe_prev = NULL;
+        if (e->env_period == 0 && TAILQ_EMPTY(q)) {
+                env_run_bitmap &= ~(1 << e->env_level);
+        }
+}
+
+/* Overview:
+ *  Move `e` to run queue level `level`, keeping its queue membership.
+ */
+void sched_set_level(struct Env *e, u_int level) {
+        int queued = e->env_sched_link.tqe_prev != NULL;
+        u_int ready_at = e->env_ready_at;
+
+        if (queued) {
+                sched_dequeue(e);
+        }
+        e->env_level = level;
+        if (queued) {
+                sched_enqueue(e);
+                e->env_ready_at = ready_at;
+        }
+}
+
+/* Overview:
+ *  Length of `e`'s time slice in ticks. `env_pri` is the slice at
+ *  SCHED_PRI_DEFAULT; each MLFQ level below doubles it and each level
+ *  above halves it, so interactive envs get short slices and CPU hogs
+ *  get long but rare ones. An EDF env runs on its remaining budget.
+ */
+static int sched_quantum(struct Env *e) {
+        int q = e->env_pri ? e->env_pri : 1;
+
+        if (e->env_period != 0) {
+                return e->env_edf_left;
+        }
+        if (e->env_level < SCHED_MLFQ_TOP || e->env_level > SCHED_MLFQ_BOTTOM) {
+                return q;
+        }
+        if (e->env_level >= SCHED_PRI_DEFAULT) {
+                return q << (e->env_level - SCHED_PRI_DEFAULT);
+        }
+        q >>= SCHED_PRI_DEFAULT - e->env_level;
+        return q ? q : 1;
+}
+
+/* Overview:
+ *  MLFQ feedback: `e` blocked before its time slice ran out, so raise it
+ *  one level. Envs whose level lies outside the MLFQ range are left alone.
+ */
+void sched_promote(struct Env *e) {
+        if (e->env_level > SCHED_MLFQ_TOP && e->env_level <= SCHED_MLFQ_BOTTOM) {
+                sched_set_level(e, e->env_level - 1);
+        }
+}
+
+/* Overview:
+ *  MLFQ feedback: `e` burned its whole time slice, so lower it one level.
+ */
+static void sched_demote(struct Env *e) {
+        if (e->env_level >= SCHED_MLFQ_TOP && e->env_level < SCHED_MLFQ_BOTTOM) {
+                sched_set_level(e, e->env_level + 1);
+        }
+}
+
+/* Overview:
+ *  Periodic priority boost against starvation: every runnable env that
+ *  was demoted below SCHED_PRI_DEFAULT goes back to it.
+ */
+static void sched_boost(void) {
+        struct Env *e;
+        int i;
+
+        for (i = SCHED_PRI_DEFAULT + 1; i <= SCHED_MLFQ_BOTTOM; i++) {
+                while (!TAILQ_EMPTY(env_run_queue + i)) {
+                        e = TAILQ_FIRST(env_run_queue + i);
+                        sched_set_level(e, SCHED_PRI_DEFAULT);
+                }
+        }
+}
+
+/* Overview:
+ *  Put `e` in the EDF class with a reservation of `budget` ticks every
+ *  `period` ticks, or move it back to round-robin if `period` is 0.
+ *
+ * Post-Condition:
+ *  Return 0 on success, -E_INVAL for a budget of 0 or above the period,
+ *  and -E_OVERLOAD if the reservation would push the admitted EDF
+ *  utilization over SCHED_EDF_UTIL; `e` is then left as it was.
+ */
+int sched_set_edf(struct Env *e, u_int period, u_int budget) {
+        int queued = e->env_sched_link.tqe_prev != NULL;
+        u_int util = 0, old = 0;
+
+        if (period != 0) {
+                if (budget == 0 || budget > period) {
+                        return -E_INVAL;
                 }
+                util = (budget * 1000 + period - 1) / period;
+        }
+        if (e->env_period != 0) {
+                old = (e->env_budget * 1000 + e->env_period - 1) / e->env_period;
+        }
+        if (edf_util - old + util > SCHED_EDF_UTIL) {
+                return -E_OVERLOAD;
+        }
+        if (queued) {
+                sched_dequeue(e);
+        }
+        edf_util = edf_util - old + util;
+        e->env_period = period;
+        e->env_budget = budget;
+        e->env_edf_left = budget;
+        e->env_deadline = sched_ticks + period;
+        if (queued) {
+                sched_enqueue(e);
+        }
+        return 0;
+}
+
+/* Overview:
+ *  Charge `elapsed` ticks to curenv's budget if it is an EDF env, then
+ *  start the next period of every EDF env whose deadline has passed. An
+ *  env still holding budget at its deadline has missed it.
+ */
+static void sched_edf_tick(u_int elapsed) {
+        struct Env *e, *next;
+        int queued;
+
+        if (curenv != NULL && curenv->env_period != 0) {
+                queued = curenv->env_sched_link.tqe_prev != NULL;
+                if (queued) {
+                        sched_dequeue(curenv);
+                }
+                curenv->env_edf_left -= elapsed < curenv->env_edf_left ? elapsed : curenv->env_edf_left;
+                if (queued) {
+                        sched_edf_insert(curenv);
+                }
+        }
+        for (e = TAILQ_FIRST(&edf_throttled); e != NULL; e = next) {
+                next = TAILQ_NEXT(e, env_sched_link);
+                if ((int)(e->env_deadline - sched_ticks) <= 0) {
+                        sched_dequeue(e);
+                        sched_edf_insert(e);
+                }
+        }
+        while ((e = TAILQ_FIRST(&edf_queue)) != NULL && (int)(e->env_deadline - sched_ticks) <= 0) {
+                e->env_edf_miss++;
+                sched_dequeue(e);
+                sched_edf_insert(e);
+        }
+}
+
+static int times = 0; /* remaining ticks of the current time slice */
+static struct Env *cur = NULL; /* env that owns the time slice */
+
+static int preempting = 0;      /* sched_yield was entered from the timer */
+#ifdef SCHED_GANG
+static int gang_left = 0;       /* slices the group at the head may still use */
 #endif
-                if (LIST_EMPTY(env_sched_list+pos)) {
-                        pos ^= 1;
-#ifdef DEBUG
-                        printf("sched_yield@sched.c: current env sched list is empty, switched to env sched list %d\n", pos);
+
+u_int sched_idle_ticks = 0;     /* ticks spent with nothing to run */
+u_int sched_idle_count = 0;     /* times the idle path was entered */
+
+/* Overview:
+ *  Nothing is runnable. Save curenv, top up the zero page pool and wait
+ *  in kclock_idle for the next clock interrupt, which is charged to
+ *  sched_idle_ticks. The clock is not reprogrammed: the gxemul RTC only
+ *  takes a whole number of interrupts per second and KCLOCK_HZ is already
+ *  the slowest, so pending timers and EDF replenishments are served by
+ *  the ticks as usual. Never returns.
+ */
+static void sched_idle(void) {
+        env_park();
+        sched_idle_count++;
+        page_zero_refill();
+        kclock_idle();
+}
+
+/* Overview:
+ *  `e` used up its time slice while runnable: demote it and move it
+ *  behind its peers. With SCHED_GANG, a thread group at the head of the
+ *  queue is handled as one unit: the slice passes to the next sibling
+ *  until every member has had one, then the whole group goes to the tail.
+ */
+static void sched_expire(struct Env *e) {
+#ifdef SCHED_GANG
+        struct Env_tailq *q;
+        struct Env *s;
+        int n;
 #endif
+
+        sched_dequeue(e);
+        sched_demote(e);
+        e->env_ready_at = sched_ticks;
+#ifdef SCHED_GANG
+        q = env_run_queue + e->env_level;
+        s = TAILQ_FIRST(q);
+        if (s != NULL && sched_gang_same(s, e)) {
+                for (n = 1; TAILQ_NEXT(s, env_sched_link) != NULL &&
+                                sched_gang_same(TAILQ_NEXT(s, env_sched_link), e); n++) {
+                        s = TAILQ_NEXT(s, env_sched_link);
+                }
+                if (--gang_left > 0) {
+                        /* keep the group at the head, `e` goes last in it */
+                        TAILQ_INSERT_AFTER(q, s, e, env_sched_link);
+                        return;
                 }
-                if (LIST_EMPTY(env_sched_list+pos)) {
+                while (n-- > 0) {
+                        s = TAILQ_FIRST(q);
+                        TAILQ_REMOVE(q, s, env_sched_link);
+                        TAILQ_INSERT_TAIL(q, s, env_sched_link);
+                }
+        }
+#endif
+        sched_enqueue(e);
+}
+
+/* Overview:
+ *  Timer interrupt entry of the scheduler, jumped to from
+ *  genex.S:timer_irq. Charges one tick to the running env; an env that
+ *  used up its slice is demoted and moved behind its peers.
+ */
+void sched_intr(int irq) {
+        if (curenv == NULL) {
+                sched_idle_ticks++;
+        } else {
+                curenv->env_ticks++;
+        }
+        timer_advance(1);
+        if (++sched_ticks % SCHED_BOOST_TICKS == 0) {
+                sched_boost();
+        }
+        if (sched_ticks % SWAP_SAMPLE == 0) {
+                swap_sample();
+        }
+        sched_edf_tick(1);
+        if (cur != NULL && --times <= 0 && cur->env_status == ENV_RUNNABLE && cur->env_period == 0) {
 #ifdef DEBUG
-                        printf("sched_yield@sched.c: env sched list %d is also empty, quiting\n", pos);
+                printf("sched_intr@sched.c: time up for current env %d\n", ENVX(cur->env_id));
 #endif
-                        panic("sched_yield@sched.c: no available process to schedual\n");
-                        return;
+                sched_expire(cur);
+        }
+        preempting = 1;
+        sched_yield();
+}
+
+/* Overview:
+ *  Account a switch from `cur` to `next`: charge the outgoing env a
+ *  voluntary or involuntary switch, and the incoming one the time it
+ *  spent ready. Entering a new thread group gives it one slice per
+ *  member before it must leave the head.
+ */
+static void sched_count_switch(struct Env *next, int preempt) {
+        u_int lat = sched_ticks - next->env_ready_at;
+        int i;
+
+        sched_switches++;
+        if (cur != NULL && cur->env_status != ENV_FREE) {
+                if (preempt && cur->env_status == ENV_RUNNABLE) {
+                        cur->env_ivswitch++;
+                } else {
+                        cur->env_vswitch++;
                 }
-                e = LIST_FIRST(env_sched_list+pos);
+        }
+        next->env_wait_ticks += lat;
+        for (i = 0; lat != 0 && i < ENV_LAT_BUCKETS - 1; i++) {
+                lat >>= 1;
+        }
+        next->env_lat_hist[i]++;
+#ifdef SCHED_GANG
+        if (cur != NULL && sched_gang_same(cur, next)) {
+                sched_gang_switches++;
+                return;
+        }
+        gang_left = sched_gang_size(next);
+#endif
+}
+
+/* Overview:
+ *  Priority round-robin scheduling over the run queue.
+ *  The env at the head of the highest non-empty level keeps the CPU until
+ *  its slice is used up, it blocks, it yields, or an env at a higher level
+ *  becomes runnable. Picking the next env is O(1).
+ *  EDF envs with budget left come before all of them, earliest deadline
+ *  first.
+ */
+void sched_yield(void) {
 #ifdef DEBUG
-                printf("sched_yield@sched.c: fetched new env %x from list %d\n", e-envs, pos);
+        printf("sched_yield@sched.c called\n");
 #endif
-                times = e->env_pri;
-                LIST_REMOVE(e, env_sched_link);
-                LIST_INSERT_HEAD(env_sched_list+1-pos, e, env_sched_link);
+        struct Env *next;
+        int preempt = preempting;
+
+        preempting = 0;
+        if (env_run_bitmap == 0 && TAILQ_EMPTY(&edf_queue)) {
+                sched_idle();
+                return;
+        }
+        if (!TAILQ_EMPTY(&edf_queue)) {
+                next = TAILQ_FIRST(&edf_queue);
+        } else {
+                next = TAILQ_FIRST(env_run_queue + sched_ffs(env_run_bitmap));
+        }
+        if (next != cur || times <= 0) {
+                if (next != cur) {
+                        sched_count_switch(next, preempt);
+                }
+                cur = next;
+                times = sched_quantum(cur);
 #ifdef DEBUG
-                printf("sched_yield@sched.c: moved env %x to list %d\n", e-envs, 1-pos);
+                printf("sched_yield@sched.c: fetched new env %x from level %d\n", ENVX(cur->env_id), cur->env_level);
 #endif
         }
 #ifdef DEBUG
         printf("sched_yield@sched.c: preparing to execute, remaining time %d\n", times);
 #endif
-        times--;
-        env_run(e);
+        env_run(cur);
 }
 
+/* Overview:
+ *  Directed yield: hand the rest of the current time slice to `e` and run
+ *  it right away. The current env, if still runnable, goes behind its
+ *  peers. If `e` cannot run, is an EDF env, or an EDF env is waiting,
+ *  this is a plain sched_yield.
+ *
+ * Pre-Condition:
+ *  The trapframe of curenv has been saved at TIMESTACK.
+ */
+void sched_yield_to(struct Env *e) {
+        if (curenv != NULL && curenv->env_status == ENV_RUNNABLE) {
+                sched_dequeue(curenv);
+                sched_enqueue(curenv);
+        }
+        if (e == NULL || e == curenv || e->env_status != ENV_RUNNABLE
+                        || e->env_period != 0 || !TAILQ_EMPTY(&edf_queue)) {
+                sched_yield();
+                return;
+        }
+        /* put `e` at the head of its level so sched_yield keeps it */
+        sched_dequeue(e);
+        TAILQ_INSERT_HEAD(env_run_queue + e->env_level, e, env_sched_link);
+        env_run_bitmap |= 1 << e->env_level;
+        if (times <= 0) {
+                times = sched_quantum(e);
+        }
+        if (e != cur) {
+                sched_count_switch(e, 0);
+        }
+        cur = e;
+        env_run(e);
+}
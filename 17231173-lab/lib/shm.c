@@ -0,0 +1,187 @@
+/*
+ * Shared memory segments.
+ *
+ * A segment is a named set of pages that any env can map into its address
+ * space in one call. Attaching maps the segment's own pages, with
+ * PTE_LIBRARY so that fork shares them as well; nothing is copied.
+ * Segment pages are never swapped out, so all segments together are held
+ * to SHM_TOTAL_NPAGE pages.
+ */
+
+#include <mmu.h>
+#include <pmap.h>
+#include <shm.h>
+#include <slab.h>
+#include <error.h>
+#include <printf.h>
+
+static LIST_HEAD(, Shm) shm_list;       // live segments, looked up by key or id
+static u_int shm_next_id = 1;
+static u_int shm_npage_total;   // pages of the live segments
+
+/* Segment `id`, or NULL if there is none or `va` is not a page aligned
+ * address at which it fits below UTOP. */
+static struct Shm *shm_lookup(u_int id, u_int va) {
+        struct Shm *shm;
+
+        LIST_FOREACH(shm, &shm_list, shm_link) {
+                if (shm->shm_id == id) {
+                        break;
+                }
+        }
+        if (shm == NULL || (va & (BY2PG - 1)) || va >= UTOP
+                        || shm->shm_npage > (UTOP - va) / BY2PG) {
+                return NULL;
+        }
+        return shm;
+}
+
+/* Overview:
+ *      Create a segment of `npage` zeroed pages for env `envid`.
+ *
+ * Post-Condition:
+ *      Return the new segment, or NULL if memory ran out; nothing is left
+ *      allocated then.
+ */
+static struct Shm *shm_create(u_int key, u_int npage, u_int envid) {
+        struct Shm *shm;
+        u_int i;
+
+        if ((shm = kmalloc(sizeof(struct Shm))) == NULL) {
+                return NULL;
+        }
+        if ((shm->shm_pages = kmalloc(npage * sizeof(struct Page *))) == NULL) {
+                kfree(shm);
+                return NULL;
+        }
+        for (i = 0; i < npage; i++) {
+                if (page_alloc(&shm->shm_pages[i]) < 0) {
+                        while (i-- > 0) {
+                                page_decref(shm->shm_pages[i]);
+                        }
+                        kfree(shm->shm_pages);
+                        kfree(shm);
+                        return NULL;
+                }
+                shm->shm_pages[i]->pp_ref++;
+        }
+        shm->shm_id = shm_next_id++;
+        shm->shm_key = key;
+        shm->shm_npage = npage;
+        shm->shm_creator = envid;
+        shm_npage_total += npage;
+        LIST_INSERT_HEAD(&shm_list, shm, shm_link);
+        return shm;
+}
+
+/* Overview:
+ *      Find the segment named `key`, or create one of `size` bytes for env
+ * `envid` if there is none and `create` is set. SHM_PRIVATE always
+ * creates.
+ *
+ * Post-Condition:
+ *      Return the segment id on success, or
+ *      -E_NOT_FOUND if there is no such segment and `create` is not set,
+ *      -E_INVAL if the segment found is smaller than `size`, or `size` is
+ *              0 or more than SHM_MAX_NPAGE pages,
+ *      -E_NO_MEM if memory ran out, or the segments would hold more than
+ *              SHM_TOTAL_NPAGE pages.
+ */
+int shm_get(u_int key, u_int size, int create, u_int envid) {
+        struct Shm *shm;
+        u_int npage = ROUND(size, BY2PG) / BY2PG;
+
+        if (key != SHM_PRIVATE) {
+                LIST_FOREACH(shm, &shm_list, shm_link) {
+                        if (shm->shm_key == key) {
+                                return npage > shm->shm_npage ? -E_INVAL : shm->shm_id;
+                        }
+                }
+        }
+        if (!create) {
+                return -E_NOT_FOUND;
+        }
+        if (npage == 0 || npage > SHM_MAX_NPAGE) {
+                return -E_INVAL;
+        }
+        if (npage > SHM_TOTAL_NPAGE - shm_npage_total) {
+                return -E_NO_MEM;
+        }
+        if ((shm = shm_create(key, npage, envid)) == NULL) {
+                return -E_NO_MEM;
+        }
+        return shm->shm_id;
+}
+
+/* Overview:
+ *      Map the whole of segment `id` at `va` in `pgdir`, writable if
+ * `perm` has PTE_R.
+ *
+ * Post-Condition:
+ *      Return 0 on success, -E_INVAL if there is no such segment or it
+ *      does not fit at `va`, or -E_NO_MEM if a page table couldn't be
+ *      allocated.
+ */
+int shm_attach(u_int id, Pde *pgdir, u_int va, u_int perm) {
+        struct Shm *shm;
+
+        if ((shm = shm_lookup(id, va)) == NULL) {
+                return -E_INVAL;
+        }
+        return page_insert_range(pgdir, va, shm->shm_pages, shm->shm_npage,
+                        (perm & PTE_R) | PTE_LIBRARY);
+}
+
+/* Overview:
+ *      Unmap segment `id` from `va` in `pgdir`.
+ *
+ * Post-Condition:
+ *      Return 0 on success, -E_INVAL if there is no such segment or it is
+ *      not attached at `va`; nothing is unmapped then.
+ */
+int shm_detach(u_int id, Pde *pgdir, u_int va) {
+        struct Shm *shm;
+        Pte *pte;
+        u_int i;
+
+        if ((shm = shm_lookup(id, va)) == NULL) {
+                return -E_INVAL;
+        }
+        for (i = 0; i < shm->shm_npage; i++) {
+                pgdir_walk(pgdir, va + i * BY2PG, 0, &pte);
+                if (pte == NULL || !(*pte & PTE_V) || pa2page(*pte) != shm->shm_pages[i]) {
+                        return -E_INVAL;
+                }
+        }
+        page_remove_range(pgdir, va, shm->shm_npage);
+        return 0;
+}
+
+/* Overview:
+ *      Remove segment `id` on behalf of env `envid`: its key and id are
+ * forgotten at once, and its pages are freed once no env has them mapped
+ * any more.
+ *
+ * Post-Condition:
+ *      Return 0 on success, -E_INVAL if there is no such segment, or
+ *      -E_BAD_ENV if `envid` did not create it.
+ */
+int shm_remove(u_int id, u_int envid) {
+        struct Shm *shm;
+        u_int i;
+
+        if ((shm = shm_lookup(id, 0)) == NULL) {
+                return -E_INVAL;
+        }
+        if (shm->shm_creator != envid) {
+                return -E_BAD_ENV;
+        }
+        LIST_REMOVE(shm, shm_link);
+        shm_npage_total -= shm->shm_npage;
+        for (i = 0; i < shm->shm_npage; i++) {
+                page_decref(shm->shm_pages[i]);
+        }
+        kfree(shm->shm_pages);
+        kfree(shm);
+        return 0;
+}
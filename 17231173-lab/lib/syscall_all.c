@@ -5,6 +5,11 @@
 #include <pmap.h>
 #include <sched.h>
 #include <semaphore.h>
+#include <timer.h>
+#include <swap.h>
+#include <shm.h>
+#include <slab.h>
+#include <ide.h>
 
 // #define DPOSIX
 
@@ -52,22 +57,22 @@ void *memcpy(void *destaddr, void const *srcaddr, u_int len) {
  *      return the current environment id
  */
 u_int sys_getenvid(int sysno, int thread) {
-        if (curenv->tcb_super == NULL) {
+        struct Tcb *tcb = curenv->env_tcb;
+        u_int i;
+
+        if (tcb == NULL) {
                 if (!thread) return curenv->env_id;
                 else return (curenv->env_id) * TCB2ENV;
         }
-        struct Env *super = curenv->tcb_super;
         if (!thread) {
-                return super->env_id;
+                return tcb->tcb_leader;
         }
-        u_int i;
-        for (i = 0; i < super->tcb_cnum; i++) {
-                if (super->tcb_children[i]->env_id == curenv->env_id) {
-                        break;
+        for (i = 0; i < tcb->tcb_cnum && i < TCB2ENV; i++) {
+                if (tcb->tcb_children[i] == curenv->env_id) {
+                        return tcb->tcb_leader * TCB2ENV + i + 1;
                 }
         }
-        u_int envid = (super->env_id) * TCB2ENV;
-        return envid + i + 1;
+        return tcb->tcb_leader * TCB2ENV;
 }
 
 /* Overview:
@@ -81,9 +86,47 @@ void sys_yield(void) {
         printf("sys_yield@syscall_all.c called\n");
 #endif
         bcopy((void *)(KERNEL_SP - TF_SIZE), (void *)(TIMESTACK - TF_SIZE), TF_SIZE);
+        if (curenv->env_status == ENV_RUNNABLE) {
+                /* go behind the other envs of the same level */
+                sched_dequeue(curenv);
+                sched_enqueue(curenv);
+        }
         sched_yield();
 }
 
+/* Overview:
+ *      Directed yield: donate the rest of the current time slice to
+ * `envid` and run it immediately.
+ *
+ * Post-Condition:
+ *      If `envid` is not a runnable env, this behaves like sys_yield.
+ * This function will never return.
+ */
+void sys_yield_to(int sysno, u_int envid) {
+        struct Env *e;
+
+        bcopy((void *)(KERNEL_SP - TF_SIZE), (void *)(TIMESTACK - TF_SIZE), TF_SIZE);
+        if (envid2env(envid, &e, 0)) {
+                e = NULL;
+        }
+        sched_yield_to(e);
+}
+
+/* Overview:
+ *      Complete the current syscall with return value `ret`, then donate
+ * the rest of the time slice to `e`, which has just been woken up.
+ *
+ * Post-Condition:
+ *      This function will never return.
+ */
+static void sys_return_yield_to(struct Env *e, int ret) {
+        struct Trapframe *tf = (struct Trapframe *)(KERNEL_SP - TF_SIZE);
+
+        tf->regs[2] = ret;
+        bcopy((void *)tf, (void *)(TIMESTACK - TF_SIZE), TF_SIZE);
+        sched_yield_to(e);
+}
+
 /* Overview:
  *      This function is used to destroy the current environment.
  *
@@ -114,6 +157,8 @@ int sys_env_destroy(int sysno, u_int envid) {
 
 /* Overview:
  *      Set envid's pagefault handler entry point and exception stack.
+ *      Copy-on-write faults are resolved by the kernel and never reach the
+ *      handler, unless `flags` has PGFAULT_COW.
  *
  * Pre-Condition:
  *      xstacktop points one byte past exception stack.
@@ -123,7 +168,7 @@ int sys_env_destroy(int sysno, u_int envid) {
  *      exception stack will be set to `xstacktop`.
  *      Returns 0 on success, < 0 on error.
  */
-int sys_set_pgfault_handler(int sysno, u_int envid, u_int func, u_int xstacktop) {
+int sys_set_pgfault_handler(int sysno, u_int envid, u_int func, u_int xstacktop, u_int flags) {
         // Your code here.
 #ifdef DEBUG
         printf("sys_set_pgfault_handler@syscall_all.c called with (int sysno: %d, u_int envid: %x, u_int func, u_int xstacktop\n", sysno-9527, envid);
@@ -135,6 +180,7 @@ int sys_set_pgfault_handler(int sysno, u_int envid, u_int func, u_int xstacktop)
         }
         env->env_pgfault_handler = func;
         env->env_xstacktop = xstacktop;
+        env->env_pgfault_flags = flags;
 
 #ifdef DEBUG
         printf("sys_set_pgfault_handler@syscall_all.c: over\n");
@@ -186,6 +232,51 @@ int sys_mem_alloc(int sysno, u_int envid, u_int va, u_int perm) {
         return ret;
 }
 
+/* Overview:
+ *      Allocate `len` bytes of physically contiguous memory and map it at
+ * `va` with permission `perm` in the address space of `envid`. The block
+ * comes from the buddy allocator, rounded up to a power of two pages; the
+ * pages past `len` go straight back.
+ *
+ * Pre-Condition:
+ *      `va` is page aligned, and perm follows the rules of sys_mem_alloc.
+ *
+ * Post-Condition:
+ *      Return 0 on success, < 0 on error; on error nothing is mapped.
+ *      - [va, va+len) must lie below UTOP
+ *      - the block may be at most 2^PAGE_MAX_ORDER pages
+ */
+int sys_mem_alloc_range(int sysno, u_int envid, u_int va, u_int len, u_int perm) {
+        struct Env *env;
+        struct Page *ppage;
+        u_int n, order, i;
+        int ret;
+
+        n = ROUND(len, BY2PG) / BY2PG;
+        if (n == 0 || va & (BY2PG - 1) || va >= UTOP || n > (UTOP - va) / BY2PG) return -E_INVAL;
+        if ((perm & PTE_V) == 0 || (perm & PTE_COW) != 0) return -E_INVAL;
+        if ((ret = envid2env(envid, &env, 0))) return ret;
+        for (order = 0; (1 << order) < n; order++);
+        if ((ret = page_alloc_order(order, &ppage))) return ret;
+
+        for (i = 0; i < n; i++) {
+                if ((ret = page_insert(env->env_pgdir, ppage + i, va + i * BY2PG, perm))) {
+                        break;
+                }
+        }
+        if (ret) {
+                /* page_remove frees the pages already mapped */
+                n = i;
+                for (i = 0; i < n; i++) {
+                        page_remove(env->env_pgdir, va + i * BY2PG);
+                }
+        }
+        for (i = n; i < (1 << order); i++) {
+                page_free(ppage + i);
+        }
+        return ret;
+}
+
 /* Overview:
  *      Map the page of memory at 'srcva' in srcid's address space
  * at 'dstva' in dstid's address space with permission 'perm'.
@@ -276,6 +367,112 @@ int sys_mem_unmap(int sysno, u_int envid, u_int va) {
         //      panic("sys_mem_unmap not implemented");
 }
 
+/* Overview:
+ *      Map every page present in the `npages` pages at 'srcva' in srcid's
+ * address space at the same offset from 'dstva' in dstid's address space.
+ * Each mapping keeps the PTE_R, PTE_LIBRARY and PTE_COW bits of the
+ * source page, so a copy-on-write source stays copy-on-write on both
+ * sides; pages missing from the source are skipped.
+ *
+ * Pre-Condition:
+ *      'srcva' and 'dstva' are page aligned.
+ *
+ * Post-Condition:
+ *      Return 0 on success, < 0 on error.
+ *      - both ranges must lie below UTOP
+ *
+ * Note:
+ *      This replaces a loop of sys_mem_map calls: the envs are looked up
+ * once and the page tables walked once.
+ */
+int sys_mem_map_range(int sysno, u_int srcid, u_int srcva, u_int dstid, u_int dstva, u_int npages) {
+        struct Env *srcenv;
+        struct Env *dstenv;
+        int ret;
+
+        if ((srcva | dstva) & (BY2PG - 1)) return -E_INVAL;
+        if (srcva >= UTOP || npages > (UTOP - srcva) / BY2PG) return -E_INVAL;
+        if (dstva >= UTOP || npages > (UTOP - dstva) / BY2PG) return -E_INVAL;
+        if ((ret = envid2env(srcid, &srcenv, 0))) return ret;
+        if ((ret = envid2env(dstid, &dstenv, 0))) return ret;
+
+        return page_map_range(srcenv->env_pgdir, srcva, dstenv->env_pgdir, dstva, npages, PTE_R | PTE_LIBRARY | PTE_COW);
+}
+
+/* Overview:
+ *      Unmap the `npages` pages at 'va' in the address space of 'envid'
+ * (pages that are not mapped are silently skipped)
+ *
+ * Post-Condition:
+ *      Return 0 on success, < 0 on error.
+ *
+ * Cannot unmap pages above UTOP.
+ */
+int sys_mem_unmap_range(int sysno, u_int envid, u_int va, u_int npages) {
+        struct Env *env;
+        int ret;
+
+        if (va & (BY2PG - 1)) return -E_INVAL;
+        if (va >= UTOP || npages > (UTOP - va) / BY2PG) return -E_INVAL;
+        if ((ret = envid2env(envid, &env, 0))) return ret;
+        page_remove_range(env->env_pgdir, va, npages);
+
+        return 0;
+}
+
+/* Overview:
+ *      Look up the shared memory segment named `key`; if there is none and
+ * `create` is set, create one of `size` bytes. SHM_PRIVATE always creates
+ * a new segment.
+ *
+ * Post-Condition:
+ *      Return the segment id on success, < 0 on error.
+ */
+int sys_shm_get(int sysno, u_int key, u_int size, int create) {
+        return shm_get(key, size, create, curenv->env_id);
+}
+
+/* Overview:
+ *      Map all of segment `id` at 'va' in the caller's address space in
+ * one call, writable if `perm` has PTE_R. The pages are the segment's own,
+ * so every env that attaches it sees the same memory.
+ *
+ * Post-Condition:
+ *      Return 0 on success, < 0 on error.
+ *      - the segment must fit between 'va' and UTOP
+ */
+int sys_shm_attach(int sysno, u_int id, u_int va, u_int perm) {
+        return shm_attach(id, curenv->env_pgdir, va, perm);
+}
+
+/* Overview:
+ *      Unmap segment `id` from 'va' in the caller's address space.
+ *
+ * Post-Condition:
+ *      Return 0 on success, < 0 on error.
+ */
+int sys_shm_detach(int sysno, u_int id, u_int va) {
+        return shm_detach(id, curenv->env_pgdir, va);
+}
+
+/* Overview:
+ *      Remove segment `id`, which the caller must have created. Envs that
+ * have it attached keep its pages until they detach them or exit.
+ *
+ * Post-Condition:
+ *      Return 0 on success, < 0 on error.
+ */
+int sys_shm_remove(int sysno, u_int id) {
+        return shm_remove(id, curenv->env_id);
+}
+
+/* Overview:
+ *      Print the statistics of every kernel object cache on the console.
+ */
+void sys_kmem_stat(int sysno) {
+        kmem_stat();
+}
+
 /* Overview:
  *      Allocate a new environment.
  *
@@ -300,6 +497,7 @@ int sys_env_alloc(void) {
         bcopy(&(curenv->env_tf), &(e->env_tf), TF_SIZE);
         e->env_status = ENV_NOT_RUNNABLE;
         e->env_pri = curenv->env_pri;
+        e->env_level = curenv->env_level;
 #ifdef DEBUG
         printf("sys_env_alloc@syscall_all.c: setting pri to %d\n", e->env_pri);
 #endif
@@ -313,6 +511,155 @@ int sys_env_alloc(void) {
         //      panic("sys_env_alloc not implemented");
 }
 
+/* Overview:
+ *      Fork the current environment in one pass. The child gets a copy
+ * of the caller's register set and page tables below USTACKTOP: pages
+ * that are writable and not PTE_LIBRARY become copy-on-write in both
+ * address spaces, the rest are shared with the same permission. The Tcb
+ * at UTCB is left out: the child starts outside any thread group. The
+ * child also gets its own exception stack and the caller's page fault
+ * handler, and is made runnable before the call returns.
+ *
+ * Post-Condition:
+ *      In the child, the register set is tweaked so sys_fork returns 0.
+ *      Returns envid of new environment, or < 0 on error: -E_INVAL if
+ *      the caller belongs to a thread group. Its address space is the
+ *      whole group's, so a copy would not be the caller's alone.
+ *
+ * Note:
+ *      This does what user/fork.c used to do with two sys_mem_map calls
+ * per page, but walks each page table once and only touches the TLB for
+ * parent pages whose permission actually changed.
+ */
+int sys_fork(void) {
+        int r;
+        struct Env *e;
+        struct Page *pp;
+        Pte *pt, *cpt;
+        u_int pdeno, pteno, va, perm;
+
+        // every env sharing a page directory is in a thread group
+        if (curenv->env_tcb != NULL) {
+                return -E_INVAL;
+        }
+        bcopy((void *)KERNEL_SP - TF_SIZE, &(curenv->env_tf), TF_SIZE);
+        if ((r = env_alloc(&e, curenv->env_id))) return r;
+        bcopy(&(curenv->env_tf), &(e->env_tf), TF_SIZE);
+        e->env_status = ENV_NOT_RUNNABLE;
+        e->env_pri = curenv->env_pri;
+        e->env_level = curenv->env_level;
+        e->env_tf.pc = e->env_tf.cp0_epc;
+        e->env_tf.regs[2] = 0;
+
+        for (pdeno = 0; pdeno <= PDX(USTACKTOP - 1); pdeno++) {
+                if (!(curenv->env_pgdir[pdeno] & PTE_V)
+                                || pa2page(curenv->env_pgdir[pdeno])->pp_live == 0) {
+                        continue;
+                }
+                pt = (Pte *)KADDR(PTE_ADDR(curenv->env_pgdir[pdeno]));
+                // allocating the child's page table may swap out pages of
+                // this one, so do it before looking at them
+                if ((r = pgdir_walk(e->env_pgdir, pdeno << PDSHIFT, 1, &cpt))) {
+                        env_free(e);
+                        return r;
+                }
+                for (pteno = 0; pteno <= PTX(~0); pteno++) {
+                        va = (pdeno << PDSHIFT) | (pteno << PGSHIFT);
+                        if (va >= USTACKTOP) {
+                                break;
+                        }
+                        if (va == UTCB) {
+                                // the child is not in our thread group
+                                continue;
+                        }
+                        if ((pt[pteno] & PTE_SWAP) && (r = swap_in(curenv->env_pgdir, va, &pt[pteno]))) {
+                                env_free(e);
+                                return r;
+                        }
+                        if (!(pt[pteno] & PTE_V)) {
+                                continue;
+                        }
+                        perm = pt[pteno] & 0xfff;
+                        if ((perm & PTE_R) && !(perm & PTE_LIBRARY) && !(perm & PTE_COW)) {
+                                perm |= PTE_COW;
+                                pt[pteno] |= PTE_COW;
+                                tlb_invalidate(curenv->env_pgdir, va);
+                        }
+                        pp = pa2page(pt[pteno]);
+                        cpt[pteno] = page2pa(pp) | perm;
+                        pte2pt(cpt)->pp_live++;
+                        pp->pp_ref++;
+                }
+        }
+
+        if ((r = page_alloc(&pp))) {
+                env_free(e);
+                return r;
+        }
+        if ((r = page_insert(e->env_pgdir, pp, UXSTACKTOP - BY2PG, PTE_V | PTE_R))) {
+                page_free(pp);
+                env_free(e);
+                return r;
+        }
+        e->env_pgfault_handler = curenv->env_pgfault_handler;
+        e->env_xstacktop = curenv->env_xstacktop;
+        e->env_pgfault_flags = curenv->env_pgfault_flags;
+
+        e->env_status = ENV_RUNNABLE;
+        sched_enqueue(e);
+        return e->env_id;
+}
+
+/* Overview:
+ *      Allocate a new thread in the caller's group. The thread shares the
+ * caller's page directory and ASID, so the cost does not depend on the
+ * size of the address space. Its stack and exception stack are left to
+ * the caller, and UTHREAD is pointed at whichever thread runs.
+ *      The group's first thread also creates its Tcb, mapped read-only at
+ * UTCB. The kernel keeps a reference of its own to the page, so it stays
+ * put for as long as the group lives, and writes it through kseg0.
+ *
+ * Post-Condition:
+ *      In the thread, the register set is tweaked so sys_thread_alloc
+ *      returns 0. Returns envid of the new thread, or < 0 on error:
+ *      -E_INVAL if the caller is not the group leader, -E_NO_FREE_ENV if
+ *      the group has TCB2ENV threads already.
+ */
+int sys_thread_alloc(void) {
+        int r;
+        struct Env *e;
+        struct Page *pp;
+        struct Tcb *tcb;
+
+        if ((tcb = curenv->env_tcb) == NULL) {
+                if ((r = page_alloc(&pp)) < 0) {
+                        return r;
+                }
+                if ((r = page_insert(curenv->env_pgdir, pp, UTCB, 0)) < 0) {
+                        page_free(pp);
+                        return r;
+                }
+                pp->pp_ref++;
+                tcb = curenv->env_tcb = (struct Tcb *)page2kva(pp);
+                tcb->tcb_leader = curenv->env_id;
+        }
+        if (tcb->tcb_leader != curenv->env_id) {
+                return -E_INVAL;
+        }
+        if (tcb->tcb_cnum >= TCB2ENV) {
+                return -E_NO_FREE_ENV;
+        }
+
+        if ((r = sys_env_alloc()) < 0) {
+                return r;
+        }
+        e = ENV_SLOT(ENVX(r));
+        env_share_vm(e, curenv);
+        e->env_tcb = tcb;
+        tcb->tcb_children[tcb->tcb_cnum++] = e->env_id;
+        return e->env_id;
+}
+
 /* Overview:
  *      Set envid's env_status to status.
  *
@@ -354,11 +701,15 @@ int sys_set_env_status(int sysno, u_int envid, u_int status) {
                         }
 #endif
                 }
+                if (status == ENV_FREE) {
+                        panic("sys_set_env_status@syscall_all.c: setting env status to free\n");
+                }
                 env->env_status = status;
                 if (status == ENV_RUNNABLE) {
-                        LIST_INSERT_HEAD(env_sched_list, env, env_sched_link);
-                } else if (status == ENV_FREE) {
-                        panic("sys_set_env_status@syscall_all.c: setting env status to free\n");
+                        timer_cancel(env);
+                        sched_enqueue(env);
+                } else {
+                        sched_dequeue(env);
                 }
         } else {
                 return -E_INVAL;
@@ -368,6 +719,63 @@ int sys_set_env_status(int sysno, u_int envid, u_int status) {
         //      panic("sys_env_set_status not implemented");
 }
 
+/* Overview:
+ *      Move env `envid` to run queue level `pri` and, if `quantum` is not
+ * zero, set its time slice to `quantum` ticks. Levels inside the MLFQ
+ * range are still subject to feedback; levels outside it are fixed.
+ *
+ * Pre-Condition:
+ *      The caller must be the env itself or its parent.
+ *
+ * Post-Condition:
+ *      Returns 0 on success, < 0 on error.
+ *      Return -E_INVAL if `pri` is not a run queue level.
+ *      The change takes effect at once: the caller yields, so an env that
+ * now has a higher priority runs without waiting for the next tick.
+ */
+int sys_set_priority(int sysno, u_int envid, u_int pri, u_int quantum) {
+        struct Env *e;
+        int r;
+
+        if ((r = envid2env(envid, &e, 1)) < 0) {
+                return r;
+        }
+        if (pri >= SCHED_NPRI) {
+                return -E_INVAL;
+        }
+        sched_set_level(e, pri);
+        if (quantum != 0) {
+                e->env_pri = quantum;
+        }
+        sys_return_yield_to(NULL, 0);
+        return 0;
+}
+
+/* Overview:
+ *      Reserve `budget` ticks of CPU every `period` ticks for env `envid`
+ * and schedule it earliest-deadline-first ahead of all round-robin envs
+ * while it has budget. A zero `period` drops the reservation.
+ *
+ * Pre-Condition:
+ *      The caller must be the env itself or its parent.
+ *
+ * Post-Condition:
+ *      Returns 0 on success, < 0 on error.
+ *      Return -E_INVAL if `budget` is 0 or larger than `period`.
+ *      Return -E_OVERLOAD if admission control rejects the reservation.
+ *      Like sys_set_priority, the caller yields before returning.
+ */
+int sys_set_edf(int sysno, u_int envid, u_int period, u_int budget) {
+        struct Env *e;
+        int r;
+
+        if ((r = envid2env(envid, &e, 1)) < 0) {
+                return r;
+        }
+        sys_return_yield_to(NULL, sched_set_edf(e, period, budget));
+        return 0;
+}
+
 /* Overview:
  *      Set envid's trap frame to tf.
  *
@@ -416,9 +824,30 @@ void sys_ipc_recv(int sysno, u_int dstva) {
         curenv->env_ipc_recving = 1;
         curenv->env_ipc_dstva = dstva;
         curenv->env_status = ENV_NOT_RUNNABLE;
+        sched_dequeue(curenv);
+        sched_promote(curenv);
         sys_yield();
 }
 
+/* Overview:
+ *      Like sys_ipc_recv, but give up after `ticks` timer ticks.
+ *
+ * Post-Condition:
+ *      Return 0 when a message arrived, -E_TIMEOUT if the timer expired
+ * first, -E_INVAL if `dstva` is invalid.
+ */
+int sys_ipc_recv_timeout(int sysno, u_int dstva, u_int ticks) {
+        if (dstva >= UTOP) return -E_INVAL;
+        curenv->env_ipc_recving = 1;
+        curenv->env_ipc_dstva = dstva;
+        curenv->env_status = ENV_NOT_RUNNABLE;
+        sched_dequeue(curenv);
+        sched_promote(curenv);
+        timer_add(curenv, ticks);
+        sys_return_yield_to(NULL, 0);
+        return 0;
+}
+
 /* Overview:
  *      Try to send 'value' to the target env 'envid'.
  *
@@ -458,7 +887,9 @@ int sys_ipc_can_send(int sysno, u_int envid, u_int value, u_int srcva, u_int per
                 e->env_ipc_perm = perm;
         }
         e->env_status = ENV_RUNNABLE;
-        LIST_INSERT_HEAD(env_sched_list, e, env_sched_link);
+        timer_cancel(e);
+        sched_enqueue(e);
+        sys_return_yield_to(e, 0);
 
         return 0;
 }
@@ -526,6 +957,146 @@ int sys_read_dev(int sysno, u_int va, u_int dev, u_int len) {
         }
 }
 
+/* Overview:
+ *      Look up the page of the caller's buffer at `va` for sys_ide_rw and
+ * pin it with an extra reference, which keeps swap_out away from it. A
+ * page the disk is to be read into must be writable; a copy-on-write one
+ * gets its own copy first.
+ *
+ * Post-Condition:
+ *      Return 0 and store the page in *ppp on success, < 0 on error.
+ */
+static int ide_pin(u_int va, int write, struct Page **ppp) {
+        struct Page *pp;
+        Pte *pte;
+        int r;
+
+        if (!write && (r = page_cow_fault(curenv->env_pgdir, va, 0)) < 0) {
+                return r;
+        }
+        if ((pp = page_lookup(curenv->env_pgdir, va, &pte)) == NULL) {
+                return -E_INVAL;
+        }
+        if (!write && !(*pte & PTE_R)) {
+                return -E_INVAL;
+        }
+        pp->pp_ref++;
+        *ppp = pp;
+        return 0;
+}
+
+/* Overview:
+ *      Transfer `nsect` sectors of disk `diskno`, from sector `secno` on,
+ * straight between the disk and the caller's buffer at 'va': read them
+ * into it, or write them from it if `write` is set. This replaces the
+ * four sys_write_dev/sys_read_dev calls per sector of a driver in user
+ * space with one call per request.
+ *
+ * Pre-Condition:
+ *      'va' is sector aligned, so that no sector straddles two pages.
+ *
+ * Post-Condition:
+ *      Return 0 once every sector has been transferred, < 0 on error:
+ *      - -E_INVAL if the buffer is not aligned, not below UTOP or not all
+ *              mapped (writable, for a read), if `nsect` is 0 or more than
+ *              IDE_MAX_NSECT, or if `diskno` is the swap disk
+ *      - -E_NO_MEM if memory ran out
+ *      - -E_IO if the disk failed a sector; the sectors before it have
+ *              been transferred
+ *
+ * Hint: every page of the buffer is pinned before the first sector moves,
+ *      so the data goes through kseg0 without faulting, and no page can
+ *      be swapped out or replaced under the transfer.
+ */
+int sys_ide_rw(int sysno, u_int diskno, u_int secno, u_int va, u_int nsect, int write) {
+        struct Page **pps;
+        u_int npage, off, cnt, done, i, j;
+        int r = 0;
+
+        if (diskno == SWAP_DISKNO || (va & (IDE_SECT - 1)) || nsect == 0
+                        || nsect > IDE_MAX_NSECT || va >= UTOP
+                        || nsect > (UTOP - va) / IDE_SECT) {
+                return -E_INVAL;
+        }
+        npage = (ROUND(va + nsect * IDE_SECT, BY2PG) - ROUNDDOWN(va, BY2PG)) / BY2PG;
+        if ((pps = kmalloc(npage * sizeof(struct Page *))) == NULL) {
+                return -E_NO_MEM;
+        }
+        for (i = 0; i < npage && r == 0; i++) {
+                r = ide_pin(ROUNDDOWN(va, BY2PG) + i * BY2PG, write, &pps[i]);
+        }
+        if (r < 0) {
+                i--;    // the last page was not pinned
+        }
+
+        off = va & (BY2PG - 1);
+        for (j = 0, done = 0; r == 0 && done < nsect; j++, off = 0) {
+                cnt = MIN((BY2PG - off) / IDE_SECT, nsect - done);
+                r = ide_rw(diskno, secno + done, (void *)page2kva(pps[j]) + off, cnt, write);
+                done += cnt;
+        }
+
+        while (i-- > 0) {
+                page_decref(pps[i]);
+        }
+        kfree(pps);
+        return r;
+}
+
+/* Overview:
+ *      Resolve the user semaphore `s`, following `shared`, to the kernel
+ * address of the same memory, so that its wait queue stays valid from
+ * any address space (timer expiry runs in whichever env is current).
+ * The kernel writes the semaphore through kseg0, past the PTE, so a
+ * copy-on-write page gets its own copy first.
+ *
+ * Post-Condition:
+ *      Return NULL if the semaphore is not mapped writable.
+ */
+static sem_t *sem_lookup(sem_t *s) {
+        sem_t *sem = s;
+        struct Page *pp;
+        Pte *pte;
+
+        if (s->shared != NULL) {
+                sem = (sem_t *) s->shared;
+        }
+        if (page_cow_fault(curenv->env_pgdir, (u_long)sem, 0) < 0) {
+                return NULL;
+        }
+        pp = page_lookup(curenv->env_pgdir, (u_long)sem, &pte);
+        if (pp == NULL || !(*pte & PTE_R)) {
+                return NULL;
+        }
+        return (sem_t *)(page2kva(pp) + ((u_long)sem & (BY2PG - 1)));
+}
+
+/* Overview:
+ *      Block curenv on the kernel semaphore `sem`. The semaphore's page
+ * is pinned until curenv leaves the queue, so that it can be neither
+ * swapped out nor freed while the queue links point into it.
+ */
+static void sem_block(sem_t *sem) {
+        pa2page(PADDR(sem))->pp_ref++;
+        LIST_INSERT_HEAD(&sem->queue, curenv, env_blocked_link);
+        curenv->env_sem = sem;
+        curenv->env_status = ENV_NOT_RUNNABLE;
+        sched_dequeue(curenv);
+        sched_promote(curenv);
+}
+
+/* Overview:
+ *      Take `e` off the semaphore it waits on and make it runnable.
+ */
+static void sem_wake(struct Env *e) {
+        LIST_REMOVE(e, env_blocked_link);
+        page_decref(pa2page(PADDR(e->env_sem)));
+        e->env_sem = NULL;
+        timer_cancel(e);
+        e->env_status = ENV_RUNNABLE;
+        sched_enqueue(e);
+}
+
 int sys_sem_init(int sysno, sem_t *s, u_int value, int shared) {
 #ifdef DPOSIX
         printf("sys_sem_init@syscall_all.c called with (sem_t *s: %x, u_int value: %x, int shared: %d)\n", s, value, shared);
@@ -548,17 +1119,13 @@ int sys_sem_destroy(int sysno, sem_t *s) {
 #ifdef DPOSIX
         printf("sys_sem_destroy@syscall_all.c called with (sem_t *s: %x)\n", s);
 #endif
-        sem_t *sem = s;
-        if (s->shared != NULL) {
-                sem = (sem_t *) s->shared;
+        sem_t *sem = sem_lookup(s);
+        if (sem == NULL) {
+                return -E_INVAL;
         }
         sem->count = 0;
-        struct Env *e;
         while (!LIST_EMPTY(&sem->queue)) {
-                e = LIST_FIRST(&sem->queue);
-                LIST_REMOVE(e, env_blocked_link);
-                e->env_status = ENV_RUNNABLE;
-                LIST_INSERT_HEAD(env_sched_list, e, env_sched_link);
+                sem_wake(LIST_FIRST(&sem->queue));
         }
         return 0;
 }
@@ -567,16 +1134,15 @@ int sys_sem_wait(int sysno, sem_t *s) {
 #ifdef DPOSIX
         printf("sys_sem_wait@syscall_all.c called with (sem_t *s: %x)\n", s);
 #endif
-        sem_t *sem = s;
-        if (s->shared != NULL) {
-                sem = (sem_t *) s->shared;
+        sem_t *sem = sem_lookup(s);
+        if (sem == NULL) {
+                return -E_INVAL;
         }
 #ifdef DPOSIX
         printf("sys_sem_wait@syscall_all.c: current value of sem is %x\n", sem->count);
 #endif
         if (sem->count-- <= 0) {
-                LIST_INSERT_HEAD(&sem->queue, curenv, env_blocked_link);
-                curenv->env_status = ENV_NOT_RUNNABLE;
+                sem_block(sem);
 #ifdef DPOSIX
                 printf("sys_sem_wait@syscall_all.c: turning into blocked status\n");
 #endif
@@ -585,10 +1151,32 @@ int sys_sem_wait(int sysno, sem_t *s) {
         return 0;
 }
 
+/* Overview:
+ *      Like sys_sem_wait, but give up after `ticks` timer ticks. The
+ * caller is descheduled right here instead of yielding from user space.
+ *
+ * Post-Condition:
+ *      Return 0 once the semaphore is taken, -E_TIMEOUT if the timer
+ * expired first.
+ */
+int sys_sem_timedwait(int sysno, sem_t *s, u_int ticks) {
+        sem_t *sem = sem_lookup(s);
+        if (sem == NULL) {
+                return -E_INVAL;
+        }
+        if (sem->count-- > 0) {
+                return 0;
+        }
+        sem_block(sem);
+        timer_add(curenv, ticks);
+        sys_return_yield_to(NULL, 0);
+        return 0;
+}
+
 int sys_sem_trywait(int sysno, sem_t *s) {
-        sem_t *sem = s;
-        if (s->shared != NULL) {
-                sem = (sem_t *) s->shared;
+        sem_t *sem = sem_lookup(s);
+        if (sem == NULL) {
+                return -E_INVAL;
         }
         if (sem->count <= 0) {
                 return 1;
@@ -602,9 +1190,9 @@ int sys_sem_post(int sysno, sem_t *s) {
 #ifdef DPOSIX
         printf("sys_sem_post called with (sem_t *s: %x)\n", s);
 #endif
-        sem_t *sem = s;
-        if (s->shared != NULL) {
-                sem = (sem_t *) s->shared;
+        sem_t *sem = sem_lookup(s);
+        if (sem == NULL) {
+                return -E_INVAL;
         }
 #ifdef DPOSIX
         printf("sys_sem_post@syscall_all.c: current value of sem is %x\n", sem->count);
@@ -612,9 +1200,8 @@ int sys_sem_post(int sysno, sem_t *s) {
         struct Env *e;
         if (sem->count++ < 0) {
                 e = LIST_FIRST(&sem->queue);
-                LIST_REMOVE(e, env_blocked_link);
-                e->env_status = ENV_RUNNABLE;
-                LIST_INSERT_HEAD(env_sched_list, e, env_sched_link);
+                sem_wake(e);
+                sys_return_yield_to(e, 0);
         }
         return 0;
 }
@@ -623,9 +1210,9 @@ int sys_sem_getvalue(int sysno, sem_t *s, int *sval) {
 #ifdef DPOSIX
         printf("sys_sem_getvalue@syscall_all.c called with (sem_t *s: %x, int *sval: %x)\n", s, sval);
 #endif
-        sem_t *sem = s;
-        if (s->shared != NULL) {
-                sem = (sem_t *) s->shared;
+        sem_t *sem = sem_lookup(s);
+        if (sem == NULL) {
+                return -E_INVAL;
         }
 #ifdef DPOSIX
         printf("sys_sem_getvalue@syscall_all.c: current value of sem is %d\n", sem->count);
@@ -634,3 +1221,20 @@ int sys_sem_getvalue(int sysno, sem_t *s, int *sval) {
         return 0;
 }
 
+/* Overview:
+ *      Block the current env for `ticks` timer ticks without keeping it
+ * on the run queue.
+ *
+ * Post-Condition:
+ *      Return 0 after the time has passed. A zero `ticks` is a yield.
+ */
+int sys_sleep(int sysno, u_int ticks) {
+        if (ticks != 0) {
+                curenv->env_status = ENV_NOT_RUNNABLE;
+                sched_dequeue(curenv);
+                sched_promote(curenv);
+                timer_add(curenv, ticks);
+        }
+        sys_return_yield_to(NULL, 0);
+        return 0;
+}
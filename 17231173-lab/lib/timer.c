@@ -0,0 +1,130 @@
+#include <env.h>
+#include <error.h>
+#include <sched.h>
+#include <semaphore.h>
+#include <timer.h>
+#include <pmap.h>
+#include <printf.h>
+
+u_int timer_jiffies = 0;
+
+static struct Env_list tv1[TVR_SIZE];   /* expiry within TVR_SIZE ticks */
+static struct Env_list tv2[TVN_SIZE];   /* expiry within TVR_SIZE * TVN_SIZE */
+
+/* Overview:
+ *  Put `e` into the wheel slot matching `e->env_timeout`. O(1).
+ */
+static void timer_insert(struct Env *e) {
+        u_int expires = e->env_timeout;
+        u_int idx = expires - timer_jiffies;
+
+        if ((int)idx < 0) {
+                /* already due, fire on the next tick */
+                LIST_INSERT_HEAD(tv1 + (timer_jiffies & TVR_MASK), e, env_timer_link);
+        } else if (idx < TVR_SIZE) {
+                LIST_INSERT_HEAD(tv1 + (expires & TVR_MASK), e, env_timer_link);
+        } else if (idx < (1 << (TVR_BITS + TVN_BITS))) {
+                LIST_INSERT_HEAD(tv2 + ((expires >> TVR_BITS) & TVN_MASK), e, env_timer_link);
+        } else {
+                /* too far out: park in the last slot, cascade re-sorts it */
+                expires = timer_jiffies + (1 << (TVR_BITS + TVN_BITS)) - 1;
+                LIST_INSERT_HEAD(tv2 + ((expires >> TVR_BITS) & TVN_MASK), e, env_timer_link);
+        }
+}
+
+/* Overview:
+ *  Empty both levels of the wheel.
+ */
+void timer_init(void) {
+        int i;
+        for (i = 0; i < TVR_SIZE; i++) {
+                LIST_INIT(tv1 + i);
+        }
+        for (i = 0; i < TVN_SIZE; i++) {
+                LIST_INIT(tv2 + i);
+        }
+}
+
+/* Overview:
+ *  Arm `e`'s timer to expire `ticks` ticks from now, replacing any timer
+ *  it already had.
+ *
+ * Pre-Condition:
+ *  `e` is blocked; expiry makes it runnable again.
+ */
+void timer_add(struct Env *e, u_int ticks) {
+        timer_cancel(e);
+        e->env_timeout = timer_jiffies + (ticks ? ticks : 1);
+        timer_insert(e);
+}
+
+/* Overview:
+ *  Disarm `e`'s timer. Does nothing if it is not armed.
+ */
+void timer_cancel(struct Env *e) {
+        if (e->env_timer_link.le_prev == NULL) {
+                return;
+        }
+        LIST_REMOVE(e, env_timer_link);
+        e->env_timer_link.le_prev = NULL;
+}
+
+/* Overview:
+ *  `e`'s timer went off: abort whatever it was waiting for and make it
+ *  runnable. A timed-out semaphore wait or IPC receive returns
+ *  -E_TIMEOUT; a plain sleep returns 0.
+ */
+static void timer_expire(struct Env *e) {
+        sem_t *sem;
+
+        if (e->env_sem != NULL) {
+                sem = (sem_t *)e->env_sem;
+                LIST_REMOVE(e, env_blocked_link);
+                sem->count++;
+                page_decref(pa2page(PADDR(sem)));
+                e->env_sem = NULL;
+                e->env_tf.regs[2] = -E_TIMEOUT;
+        } else if (e->env_ipc_recving) {
+                e->env_ipc_recving = 0;
+                e->env_tf.regs[2] = -E_TIMEOUT;
+        }
+        if (e->env_status == ENV_NOT_RUNNABLE) {
+                e->env_status = ENV_RUNNABLE;
+                sched_enqueue(e);
+        }
+}
+
+/* Overview:
+ *  Move every timer of tv2 slot `idx` down into tv1.
+ */
+static void timer_cascade(u_int idx) {
+        struct Env *e;
+
+        while (!LIST_EMPTY(tv2 + idx)) {
+                e = LIST_FIRST(tv2 + idx);
+                LIST_REMOVE(e, env_timer_link);
+                timer_insert(e);
+        }
+}
+
+/* Overview:
+ *  Process `ticks` ticks, firing every timer that expires on them. Each
+ *  tick costs one slot of tv1, plus one slot of tv2 every TVR_SIZE ticks.
+ */
+void timer_advance(u_int ticks) {
+        struct Env *e;
+        u_int idx;
+
+        while (ticks-- > 0) {
+                idx = timer_jiffies & TVR_MASK;
+                if (idx == 0) {
+                        timer_cascade((timer_jiffies >> TVR_BITS) & TVN_MASK);
+                }
+                while (!LIST_EMPTY(tv1 + idx)) {
+                        e = LIST_FIRST(tv1 + idx);
+                        timer_cancel(e);
+                        timer_expire(e);
+                }
+                timer_jiffies++;
+        }
+}
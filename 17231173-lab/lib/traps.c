@@ -1,6 +1,7 @@
 #include <trap.h>
 #include <env.h>
 #include <printf.h>
+#include <pmap.h>
 
 extern void handle_int();
 extern void handle_reserved();
@@ -47,6 +48,19 @@ void page_fault_handler(struct Trapframe *tf) {
 #endif
         struct Trapframe PgTrapFrame;
         extern struct Env *curenv;
+        int r;
+
+        // copy-on-write is resolved right here, without a trip through the
+        // user handler, unless the env asked for PTE_COW faults itself;
+        // the shared zero page is always handled here
+        r = page_cow_fault(curenv->env_pgdir, tf->cp0_badvaddr,
+                        curenv->env_pgfault_flags & PGFAULT_COW);
+        if (r > 0) {
+                return;
+        }
+        if (r < 0) {
+                panic("page_fault_handler@traps.c: no page for copy-on-write at %x\n", tf->cp0_badvaddr);
+        }
 
         bcopy(tf, &PgTrapFrame, TF_SIZE);
 
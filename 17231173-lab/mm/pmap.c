@@ -4,6 +4,7 @@
 #include "env.h"
 #include "error.h"
 #include "queue.h"
+#include "swap.h"
 
 
 /* These variables are set by mips_detect_memory() */
@@ -15,9 +16,20 @@ u_long extmem;           /* Amount of extended memory(in bytes) */
 Pde *boot_pgdir;
 
 struct Page *pages;
+struct Page *zero_page;         /* shared, read-only, never freed */
+
+static u_int asid_generation = NASID;   /* generation in the bits above the ASID */
+static u_int asid_next = 1;
+static Pde *asid_pgdir[NASID];  /* address space of each ASID in this generation */
+
+extern u_long kvpt_zero;        /* KVPT entry for a missing page table */
+
+static int asid_lookup(Pde *pgdir);
 static u_long freemem;
 
-static struct Page_list page_free_list; /* Free list of physical pages */
+static struct Page_list page_free_list[PAGE_MAX_ORDER + 1];    /* Free blocks of each order */
+static struct Page_list page_zero_list; /* Free pages already cleared */
+static u_int page_zero_count;
 
 
 /* Overview:
@@ -189,7 +201,6 @@ void boot_map_segment(Pde *pgdir, u_long va, u_long size, u_long pa, int perm) {
 void mips_vm_init() {
     extern char end[];
     extern int mCONTEXT;
-    extern struct Env *envs;
 
     Pde *pgdir;
     u_int n;
@@ -220,17 +231,17 @@ void mips_vm_init() {
     n = ROUND(npage * sizeof(struct Page), BY2PG);
     boot_map_segment(pgdir, UPAGES, n, PADDR(pages), PTE_R);
 
-        /* envs */
+        /* envs: the first chunk; env_alloc maps more behind it */
 #ifdef DEBUG
         printf("mips_vm_init@pmap.c: calling alloc for envs\n");
 #endif
-    envs = (struct Env *)alloc(NENV * sizeof(struct Env), BY2PG, 1);
+    env_chunks[0] = (struct Env *)alloc(ENV_CHUNK * sizeof(struct Env), BY2PG, 1);
 #ifdef DEBUG
-        printf("mips_vm_init@pmap.c: pages set to %x\n", pages);
+        printf("mips_vm_init@pmap.c: envs set to %x\n", env_chunks[0]);
 #endif
 
-    n = ROUND(NENV * sizeof(struct Env), BY2PG);
-    boot_map_segment(pgdir, UENVS, n, PADDR(envs), PTE_R);
+    n = ROUND(ENV_CHUNK * sizeof(struct Env), BY2PG);
+    boot_map_segment(pgdir, UENVS, n, PADDR(env_chunks[0]), PTE_R);
 
     printf("pmap.c:\t mips vm init success\n");
 }
@@ -239,17 +250,33 @@ void mips_vm_init() {
  * for physical memory management. Then, map virtual address `UPAGES` to
  * physical address `pages` allocated before. For consideration of alignment,
  * you should round up the memory size before map. */
-/* Step 3, Allocate proper size of physical memory for global array `envs`,
- * for process management. Then map the physical address to `UENVS`. */
+/* Step 3, Allocate proper size of physical memory for the first chunk of
+ * `envs`, for process management. Then map the physical address to `UENVS`. */
+
+/* Overview:
+        Put the free block of 2^`order` pages starting at `pp` on its free list. */
+static void page_free_block(struct Page *pp, u_int order) {
+        pp->pp_free = 1;
+        pp->pp_order = order;
+        LIST_INSERT_HEAD(&page_free_list[order], pp, pp_link);
+}
 
 /*Overview:
         Initialize page structure and memory free list.
         The `pages` array has one `struct Page` entry per physical page. Pages
-        are reference counted, and free pages are kept on a linked list.
+        are reference counted, and free pages are kept in buddy blocks: each
+        free block of 2^order pages is aligned to its size and sits on
+        page_free_list[order].
   Hint:
         Use `LIST_INSERT_HEAD` to insert something to list.*/
 void page_init(void) {
-        LIST_INIT(&page_free_list);
+        int i, order;
+
+        for (i = 0; i <= PAGE_MAX_ORDER; i++) {
+                LIST_INIT(&page_free_list[i]);
+        }
+        LIST_INIT(&page_zero_list);
+        page_zero_count = 0;
 #ifdef DEBUG
         printf("page_init@pmap.c: page_free_list initialized.\n");
 #endif
@@ -260,10 +287,10 @@ void page_init(void) {
 #endif
 
         int used = (freemem - ULIM) / BY2PG;
-        int i = 0;
         struct Page *p = pages;
-        for (; i < used; p++, i++) {
+        for (i = 0; i < used; p++, i++) {
                 p->pp_ref = 1;
+                p->pp_free = 0;
         }
 #ifdef DEBUG
         printf("page_init@pmap.c: all memory below `freemem` set as used. Cursor running to %d, at page %x\n", i, p);
@@ -271,19 +298,28 @@ void page_init(void) {
 
         for (; i < npage; p++, i++) {
                 p->pp_ref = 0;
-                LIST_INSERT_HEAD(&page_free_list, p, pp_link);
+                p->pp_free = 0;
+        }
+        for (i = used; i < npage; i += 1 << order) {
+                /* largest aligned block that starts at page i and fits */
+                for (order = PAGE_MAX_ORDER; order > 0; order--) {
+                        if ((i & ((1 << order) - 1)) == 0 && i + (1 << order) <= npage) {
+                                break;
+                        }
+                }
+                page_free_block(&pages[i], order);
         }
-//      struct Page *ptemp = pages + npage - 1;
-//#ifdef DEBUG
-//      printf("page_init@pmap.c: ptemp initialized to %x\n", ptemp);
-//#endif
-//      for (; i < npage; ptemp--, i++) {
-//              ptemp->pp_ref = 0;
-//              LIST_INSERT_HEAD(&page_free_list, ptemp, pp_link);
-//      }
 #ifdef DEBUG
-        printf("page_init@pmap.c: other memory marked as free. Cursor running to %d, at page %x\npage_init@pmap.c: end\n", i, ptemp);
+        printf("page_init@pmap.c: other memory marked as free. Cursor running to %d\npage_init@pmap.c: end\n", i);
 #endif
+
+        // the reference held here keeps the zero page from ever being freed
+        if (page_alloc(&zero_page) < 0) {
+                panic("page_init@pmap.c: no page left for the zero page\n");
+        }
+        zero_page->pp_ref = 1;
+        // and it stands in for a missing page table in KVPT, see start.S
+        kvpt_zero = page2pa(zero_page) | PTE_V;
 }
 /* Step 1: Initialize page_free_list. */
 /* Hint: Use macro `LIST_INIT` defined in include/queue.h. */
@@ -292,6 +328,78 @@ void page_init(void) {
  * filed to 1) */
 /* Step 4: Mark the other memory as free. */
 
+/*Overview:
+        Take 2^`order` physically contiguous pages from the buddy free lists
+        without clearing them. The smallest free block that is large enough
+        is split, and the halves not needed go back to the free lists.*/
+static int page_alloc_block(u_int order, struct Page **pp) {
+        struct Page *ppage;
+        u_int k;
+
+        if (order > PAGE_MAX_ORDER) {
+                return -E_INVAL;
+        }
+        for (k = order; k <= PAGE_MAX_ORDER && LIST_EMPTY(&page_free_list[k]); k++);
+        if (k > PAGE_MAX_ORDER) {
+#ifdef DEBUG
+                printf("page_alloc_block@pmap.c: no free block of order %d, returnning -E_NO_MEM\n", order);
+#endif
+                return -E_NO_MEM;
+        }
+
+        ppage = LIST_FIRST(&page_free_list[k]);
+        LIST_REMOVE(ppage, pp_link);
+        ppage->pp_free = 0;
+        while (k > order) {
+                k--;
+                page_free_block(ppage + (1 << k), k);
+        }
+#ifdef DEBUG
+        printf("page_alloc_block@pmap.c: fetched block of order %d at %x\n", order, ppage);
+#endif
+        *pp = ppage;
+        return 0;
+}
+
+/*Overview:
+        Allocates 2^`order` physically contiguous pages from free memory, and
+        clear them. A single page comes from the pre-zeroed pool when it has
+        one, so it needs no clearing here.
+
+  Post-Condition:
+        If failed to allocate a block(out of memory, or memory too
+        fragmented), return -E_NO_MEM; return -E_INVAL if `order` exceeds
+        PAGE_MAX_ORDER. A single page is made free by swapping a user page
+        out when there is none left.
+        Else, set the address of the first page to *pp, and returned 0.
+        The pages are handed out one by one: each has its own `pp_ref` and
+        may be freed on its own with page_free.
+
+  Note:
+        Does NOT increment the reference count of the pages - the caller must
+        do these if necessary (either explicitly or via page_insert).*/
+int page_alloc_order(u_int order, struct Page **pp) {
+        struct Page *ppage;
+        int r;
+
+        if (order == 0 && !LIST_EMPTY(&page_zero_list)) {
+                ppage = LIST_FIRST(&page_zero_list);
+                LIST_REMOVE(ppage, pp_link);
+                page_zero_count--;
+                *pp = ppage;
+                return 0;
+        }
+        while ((r = page_alloc_block(order, &ppage))) {
+                if (order != 0 || swap_out() < 0) {
+                        return r;
+                }
+        }
+        bzero((void *)page2kva(ppage), BY2PG << order);
+
+        *pp = ppage;
+        return 0;
+}
+
 /*Overview:
         Allocates a physical page from free memory, and clear this page.
 
@@ -302,52 +410,60 @@ void page_init(void) {
 
   Note:
         Does NOT increment the reference count of the page - the caller must do
-        these if necessary (either explicitly or via page_insert).
-
-  Hint:
-        Use LIST_FIRST and LIST_REMOVE defined in include/queue.h .*/
+        these if necessary (either explicitly or via page_insert).*/
 int page_alloc(struct Page **pp) {
-    struct Page *ppage_temp;
+        return page_alloc_order(0, pp);
+}
 
-        if (LIST_EMPTY(&page_free_list)) {
-#ifdef DEBUG
-                printf("page_alloc@pmap.c: page_free_list is empty, returnning -E_NO_MEM\n");
-#endif
-                return -E_NO_MEM;
+/*Overview:
+        Like page_alloc, but the page keeps whatever it held before. Only for
+        kernel callers that overwrite the whole page before anything else can
+        see it; the pre-zeroed pool is left for page_alloc.*/
+int page_alloc_nozero(struct Page **pp) {
+        while (page_alloc_block(0, pp) != 0) {
+                if (!LIST_EMPTY(&page_zero_list)) {
+                        *pp = LIST_FIRST(&page_zero_list);
+                        LIST_REMOVE(*pp, pp_link);
+                        page_zero_count--;
+                        return 0;
+                }
+                if (swap_out() < 0) {
+                        return -E_NO_MEM;
+                }
         }
-
-        ppage_temp = LIST_FIRST(&page_free_list);
-#ifdef DEBUG
-        printf("page_alloc@pmap.c: fetched first free page at %x\n", ppage_temp);
-#endif
-        LIST_REMOVE(ppage_temp, pp_link);
-#ifdef DEBUG
-        printf("page_alloc@pmap.c: removed page from page_free_list.\n");
-#endif
-
-#ifdef DEBUG
-        printf("page_alloc@pmap.c: calling bzero to initialize page\n");
-#endif
-        bzero((void *)page2kva(ppage_temp), BY2PG);
-#ifdef DEBUG
-        printf("page_alloc@pmap.c: page initialized using bzero\n");
-#endif
-
-        *pp = ppage_temp;
         return 0;
 }
-/* Step 1: Get a page from free memory. If fails, return the error code.*/
-/* Step 2: Initialize this page.
- * Hint: use `bzero`. */
+
+/*Overview:
+        Clear up to PAGE_ZERO_BATCH free pages into the pre-zeroed pool, until
+        it holds PAGE_ZERO_MAX. Called from the idle path, so the clearing
+        happens while nothing else wants the CPU.*/
+void page_zero_refill(void) {
+        struct Page *p;
+        int n;
+
+        for (n = 0; n < PAGE_ZERO_BATCH && page_zero_count < PAGE_ZERO_MAX; n++) {
+                if (page_alloc_block(0, &p)) {
+                        return;
+                }
+                bzero((void *)page2kva(p), BY2PG);
+                LIST_INSERT_HEAD(&page_zero_list, p, pp_link);
+                page_zero_count++;
+        }
+}
 
 /*Overview:
         Release a page, mark it as free if it's `pp_ref` reaches 0.
-  Hint:
-        When to free a page, just insert it to the page_free_list.*/
+        A freed page is merged with its buddy for as long as the buddy is a
+        free block of the same order.*/
 void page_free(struct Page *pp) {
 #ifdef DEBUG
         printf("page_free@pmap.c called with (struct Page *pp: %x)\n", pp);
 #endif
+        u_long ppn;
+        u_int order;
+        struct Page *buddy;
+
         if (pp->pp_ref > 0) {
 #ifdef DEBUG
                 printf("page_free@pmap.c: pp_ref is not zero\n");
@@ -356,10 +472,25 @@ void page_free(struct Page *pp) {
         }
 
         if (pp->pp_ref == 0) {
+                pp->pp_pgdir = NULL;
+                pp->pp_envid = 0;
+                ppn = page2ppn(pp);
+                for (order = 0; order < PAGE_MAX_ORDER; order++) {
+                        if ((ppn ^ (1 << order)) >= npage) {
+                                break;
+                        }
+                        buddy = &pages[ppn ^ (1 << order)];
+                        if (!buddy->pp_free || buddy->pp_order != order) {
+                                break;
+                        }
+                        LIST_REMOVE(buddy, pp_link);
+                        buddy->pp_free = 0;
+                        ppn &= ~(1 << order);
+                }
 #ifdef DEBUG
-                printf("page_free@pmap.c: adding page to head of page_free_list\n");
+                printf("page_free@pmap.c: adding block of order %d to page_free_list\n", order);
 #endif
-                LIST_INSERT_HEAD(&page_free_list, pp, pp_link);
+                page_free_block(&pages[ppn], order);
                 return;
         }
 
@@ -410,7 +541,10 @@ int pgdir_walk(Pde *pgdir, u_long va, int create, Pte **ppte) {
                         return -E_NO_MEM;
                 }
                 ppage->pp_ref++;
+                ppage->pp_live = 0;
                 *pgdir_entryp = page2pa(ppage) | PTE_R | PTE_V;
+                // KVPT may still map the zero page in its place
+                tlb_invalidate(pgdir, KVPT + PDX(va) * BY2PG);
         }
 
         if (*pgdir_entryp == 0) {
@@ -446,27 +580,36 @@ int page_insert(Pde *pgdir, struct Page *pp, u_long va, u_int perm) {
     u_int PERM;
     Pte *pgtable_entry;
     PERM = perm | PTE_V;
+    if (pp == zero_page) {
+        // whoever maps the zero page only ever gets to read it
+        PERM = (PERM & ~(PTE_R | PTE_LIBRARY)) | PTE_COW;
+    }
 
-    pgdir_walk(pgdir, va, 0, &pgtable_entry);
+    // take the reference first: allocating a page table may swap pages
+    // out, and pp must not be one of them
+    pp->pp_ref++;
+    if (pgdir_walk(pgdir, va, 1, &pgtable_entry) != 0) {
+        pp->pp_ref--;
+        return -E_NO_MEM;
+    }
 
-    if (pgtable_entry != 0 && (*pgtable_entry & PTE_V) != 0) {
+    if ((*pgtable_entry & PTE_V) != 0) {
         if (pa2page(*pgtable_entry) != pp) {
             page_remove(pgdir, va);
-        } else{
-            tlb_invalidate(pgdir, va);
-            *pgtable_entry = (page2pa(pp) | PERM);
-            return 0;
+        } else {
+            pp->pp_ref--;
         }
+    } else if ((*pgtable_entry & PTE_SWAP) != 0) {
+        swap_free(*pgtable_entry);
+    }
+    if (!(*pgtable_entry & (PTE_V | PTE_SWAP))) {
+        pte2pt(pgtable_entry)->pp_live++;
     }
 
         tlb_invalidate(pgdir, va);
-
-        if (pgdir_walk(pgdir, va, 1, &pgtable_entry) != 0) {
-                return -E_NO_MEM;
-        }
-
         *pgtable_entry = page2pa(pp) | PERM;
-        pp->pp_ref++;
+        pp->pp_pgdir = pgdir;
+        pp->pp_va = ROUNDDOWN(va, BY2PG);
 
     return 0;
 }
@@ -477,6 +620,61 @@ int page_insert(Pde *pgdir, struct Page *pp, u_long va, u_int perm) {
 /* Step 3.1 Check if the page can be insert, if cant return -E_NO_MEM */
 /* Step 3.2 Insert page and increment the pp_ref */
 
+/*Overview:
+        Map the shared zero page at `va` read-only and copy-on-write, so
+        that a zero-filled page costs no memory until it is written.*/
+int page_insert_zero(Pde *pgdir, u_long va) {
+        return page_insert(pgdir, zero_page, va, PTE_V | PTE_COW);
+}
+
+/*Overview:
+        Resolve a write fault at `va` on a copy-on-write page in the kernel.
+        The shared zero page is replaced by a fresh cleared page. A page no
+        one else maps (`pp_ref` == 1) is just made writable again; any other
+        page is copied into a page of its own. With `zero_only` set, only
+        faults on the zero page are handled.
+
+  Post-Condition:
+        Return 1 if the fault has been resolved, 0 if `va` is not mapped
+        copy-on-write (or is not the zero page under `zero_only`), and
+        -E_NO_MEM if no page is left.*/
+int page_cow_fault(Pde *pgdir, u_long va, int zero_only) {
+        struct Page *pp, *np;
+        Pte *pte;
+        u_int perm;
+        int r;
+
+        va = ROUNDDOWN(va, BY2PG);
+        if ((pp = page_lookup(pgdir, va, &pte)) == NULL || !(*pte & PTE_COW)) {
+                return 0;
+        }
+        if (zero_only && pp != zero_page) {
+                return 0;
+        }
+        perm = (*pte & 0xfff & ~PTE_COW) | PTE_R;
+        if (pp != zero_page && pp->pp_ref == 1) {
+                // the last mapping of the page: no copy needed
+                *pte = page2pa(pp) | perm;
+                pp->pp_pgdir = pgdir;
+                pp->pp_va = va;
+                tlb_invalidate(pgdir, va);
+                return 1;
+        }
+        if (pp == zero_page) {
+                r = page_alloc(&np);
+        } else if ((r = page_alloc_nozero(&np)) == 0) {
+                bcopy((void *)page2kva(pp), (void *)page2kva(np), BY2PG);
+        }
+        if (r < 0) {
+                return r;
+        }
+        if ((r = page_insert(pgdir, np, va, perm)) < 0) {
+                page_free(np);
+                return r;
+        }
+        return 1;
+}
+
 /*Overview:
         Look up the Page that virtual address `va` map to.
 
@@ -492,6 +690,9 @@ struct Page * page_lookup(Pde *pgdir, u_long va, Pte **ppte) {
     if (pte == 0) {
         return 0;
     }
+    if ((*pte & PTE_SWAP) != 0 && swap_in(pgdir, va, pte) < 0) {
+        return 0;    //swapped out, and no page to bring it back in.
+    }
     if ((*pte & PTE_V) == 0) {
         return 0;    //the page is not in memory.
     }
@@ -522,6 +723,14 @@ void page_remove(Pde *pgdir, u_long va) {
     Pte *pagetable_entry;
     struct Page *ppage;
 
+    pgdir_walk(pgdir, va, 0, &pagetable_entry);
+    if (pagetable_entry != 0 && (*pagetable_entry & PTE_SWAP) != 0) {
+        swap_free(*pagetable_entry);
+        *pagetable_entry = 0;
+        pte2pt(pagetable_entry)->pp_live--;
+        return;
+    }
+
     ppage = page_lookup(pgdir, va, &pagetable_entry);
 
     if (ppage == 0) {
@@ -534,6 +743,7 @@ void page_remove(Pde *pgdir, u_long va) {
     }
 
     *pagetable_entry = 0;
+    pte2pt(pagetable_entry)->pp_live--;
     tlb_invalidate(pgdir, va);
     return;
 }
@@ -542,13 +752,250 @@ void page_remove(Pde *pgdir, u_long va) {
 /* Hint: When there's no virtual address mapped to this page, release it. */
 /* Step 3: Update TLB. */
 
+/* Invalidate the TLB entry for `va` as part of a batch of changes; `*n`
+ * counts them. Once a batch reaches NTLB entries probing is no longer
+ * worth it and tlb_invalidate_done drops the whole TLB instead. */
+static void tlb_invalidate_batch(Pde *pgdir, u_long va, u_int *n) {
+    if (++*n < NTLB) {
+        tlb_invalidate(pgdir, va);
+    }
+}
+
+static void tlb_invalidate_done(Pde *pgdir, u_int n) {
+    if (n >= NTLB) {
+        tlb_flush();
+    }
+}
+
+// Overview:
+//      Unmaps the `npages` pages starting at virtual address `va`. Each
+//      page table is looked up once, not once per page.
+void page_remove_range(Pde *pgdir, u_long va, u_int npages) {
+    Pte *pt = NULL;
+    u_int n = 0;
+
+    for (; npages > 0; npages--, va += BY2PG) {
+        if (pt == NULL || PTX(va) == 0) {
+            pt = (pgdir[PDX(va)] & PTE_V) ? (Pte *)KADDR(PTE_ADDR(pgdir[PDX(va)])) : NULL;
+        }
+        if (pt != NULL && (pt[PTX(va)] & PTE_SWAP)) {
+            swap_free(pt[PTX(va)]);
+            pt[PTX(va)] = 0;
+            pte2pt(pt)->pp_live--;
+        }
+        if (pt == NULL || !(pt[PTX(va)] & PTE_V)) {
+            continue;
+        }
+        page_decref(pa2page(pt[PTX(va)]));
+        pt[PTX(va)] = 0;
+        pte2pt(pt)->pp_live--;
+        tlb_invalidate_batch(pgdir, va, &n);
+    }
+    tlb_invalidate_done(pgdir, n);
+}
+
+/*Overview:
+        Map every page present in the `npages` pages at `srcva` in `srcpgdir`
+        at the same offset from `dstva` in `dstpgdir`. Each mapping keeps the
+        source permission bits in `mask`; holes in the source are skipped.
+
+  Post-Condition:
+    Return 0 on success
+    Return -E_NO_MEM, if a page table couldn't be allocated; the pages
+    before the failing one stay mapped.*/
+int page_map_range(Pde *srcpgdir, u_long srcva, Pde *dstpgdir, u_long dstva, u_int npages, u_int mask) {
+    Pte *spt = NULL, *dpt = NULL, *dpte;
+    struct Page *pp;
+    u_int perm, n = 0;
+    int r = 0;
+
+    for (; npages > 0; npages--, srcva += BY2PG, dstva += BY2PG) {
+        if (spt == NULL || PTX(srcva) == 0) {
+            spt = (srcpgdir[PDX(srcva)] & PTE_V) ? (Pte *)KADDR(PTE_ADDR(srcpgdir[PDX(srcva)])) : NULL;
+        }
+        if (PTX(dstva) == 0) {
+            dpt = NULL;
+        }
+        if (spt != NULL && (spt[PTX(srcva)] & PTE_SWAP)
+                && (r = swap_in(srcpgdir, srcva, &spt[PTX(srcva)])) != 0) {
+            break;
+        }
+        if (spt == NULL || !(spt[PTX(srcva)] & PTE_V)) {
+            continue;
+        }
+        // referenced before the page table allocation, which may swap out
+        pp = pa2page(spt[PTX(srcva)]);
+        pp->pp_ref++;
+        if (dpt == NULL) {
+            if ((r = pgdir_walk(dstpgdir, dstva, 1, &dpte)) != 0) {
+                page_decref(pp);
+                break;
+            }
+            dpt = dpte - PTX(dstva);
+        }
+        perm = (spt[PTX(srcva)] & mask) | PTE_V;
+        if (pp == zero_page) {
+            perm = (perm & ~(PTE_R | PTE_LIBRARY)) | PTE_COW;
+        }
+        dpte = dpt + PTX(dstva);
+        if (*dpte & PTE_V) {
+            page_decref(pa2page(*dpte));
+            tlb_invalidate_batch(dstpgdir, dstva, &n);
+        } else if (*dpte & PTE_SWAP) {
+            swap_free(*dpte);
+        } else {
+            pte2pt(dpt)->pp_live++;
+        }
+        *dpte = page2pa(pp) | perm;
+    }
+    tlb_invalidate_done(dstpgdir, n);
+    return r;
+}
+
+/*Overview:
+        Map the `npages` pages of `pps` at `va` in `pgdir`, one after the
+        other, with permission `perm|PTE_V`. Whatever was mapped there is
+        unmapped first.
+
+  Post-Condition:
+    Return 0 on success
+    Return -E_NO_MEM, if a page table couldn't be allocated; the pages
+    before the failing one stay mapped.*/
+int page_insert_range(Pde *pgdir, u_long va, struct Page **pps, u_int npages, u_int perm) {
+    Pte *pt = NULL, *pte;
+    u_int n = 0;
+    int r = 0;
+
+    for (; npages > 0; npages--, va += BY2PG, pps++) {
+        if (pt == NULL || PTX(va) == 0) {
+            if ((r = pgdir_walk(pgdir, va, 1, &pte)) != 0) {
+                break;
+            }
+            pt = pte - PTX(va);
+        }
+        pte = pt + PTX(va);
+        (*pps)->pp_ref++;
+        if (*pte & PTE_V) {
+            page_decref(pa2page(*pte));
+            tlb_invalidate_batch(pgdir, va, &n);
+        } else if (*pte & PTE_SWAP) {
+            swap_free(*pte);
+        } else {
+            pte2pt(pt)->pp_live++;
+        }
+        *pte = page2pa(*pps) | perm | PTE_V;
+    }
+    tlb_invalidate_done(pgdir, n);
+    return r;
+}
+
 // Overview:
 //      Update TLB.
 void tlb_invalidate(Pde *pgdir, u_long va) {
-    if (curenv) {
-        tlb_out(PTE_ADDR(va) | GET_ENV_ASID(curenv->env_id));
-    } else {
-        tlb_out(PTE_ADDR(va));
+    int asid;
+
+    if ((asid = asid_lookup(pgdir)) < 0) {
+        return;
+    }
+    tlb_out(PTE_ADDR(va) | (asid << ASID_SHIFT));
+}
+
+// Overview:
+//      Return the ASID of address space `pgdir`, or -1 if it has none: it
+//      can only have TLB entries under an ASID of the current generation.
+//      Never allocates one, so invalidating an entry cannot start a new
+//      generation.
+static int asid_lookup(Pde *pgdir) {
+    u_int i;
+
+    if (curenv != NULL && curenv->env_pgdir == pgdir
+            && (curenv->env_asid & ~(NASID - 1)) == asid_generation) {
+        return curenv->env_asid & (NASID - 1);
+    }
+    for (i = 1; i < asid_next; i++) {
+        if (asid_pgdir[i] == pgdir) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/*Overview:
+        Return the EntryHi ASID field of env `e`, giving it a new ASID if
+        the one it holds is from an older generation. ASIDs are handed out
+        in order and never reused within a generation; when they run out a
+        new generation starts and the whole TLB is flushed, so entries of
+        freed or idle envs can never be mistaken for a new owner's.
+        Threads sharing a page directory share its ASID as well.
+        ASID 0 is left to the kernel.*/
+u_int asid_alloc(struct Env *e) {
+    u_int i;
+
+    if ((e->env_asid & ~(NASID - 1)) != asid_generation) {
+        for (i = 1; i < asid_next; i++) {
+            if (asid_pgdir[i] == e->env_pgdir) {
+                e->env_asid = asid_generation | i;
+                return i << ASID_SHIFT;
+            }
+        }
+        if (asid_next == NASID) {
+            asid_generation += NASID;
+            asid_next = 1;
+            bzero(asid_pgdir, sizeof(asid_pgdir));
+            tlb_flush();
+        }
+        asid_pgdir[asid_next] = e->env_pgdir;
+        e->env_asid = asid_generation | asid_next++;
+    }
+    return (e->env_asid & (NASID - 1)) << ASID_SHIFT;
+}
+
+// Overview:
+//      Forget `e`'s address space; its ASID stays retired until the next
+//      generation. The ASID may have been taken by another thread of the
+//      group, so it is looked up by page directory.
+void asid_free(struct Env *e) {
+    u_int i;
+
+    for (i = 1; i < asid_next; i++) {
+        if (asid_pgdir[i] == e->env_pgdir) {
+            asid_pgdir[i] = NULL;
+        }
+    }
+}
+
+/* Overview:
+        Move every free block onto `fl`, leaving the allocator empty. The
+        blocks are no longer marked free, so pages freed meanwhile cannot
+        merge into them. */
+static void page_steal_free(struct Page_list *fl) {
+    struct Page *p;
+    int i;
+
+    // the pre-zeroed pool goes back to the buddy lists first
+    while ((p = LIST_FIRST(&page_zero_list)) != NULL) {
+        LIST_REMOVE(p, pp_link);
+        page_zero_count--;
+        page_free(p);
+    }
+    LIST_INIT(fl);
+    for (i = 0; i <= PAGE_MAX_ORDER; i++) {
+        while ((p = LIST_FIRST(&page_free_list[i])) != NULL) {
+            LIST_REMOVE(p, pp_link);
+            p->pp_free = 0;
+            LIST_INSERT_HEAD(fl, p, pp_link);
+        }
+    }
+}
+
+/* Overview:
+        Give the blocks taken by page_steal_free back to the allocator. */
+static void page_return_free(struct Page_list *fl) {
+    struct Page *p;
+
+    while ((p = LIST_FIRST(fl)) != NULL) {
+        LIST_REMOVE(p, pp_link);
+        page_free_block(p, p->pp_order);
     }
 }
 
@@ -568,9 +1015,8 @@ void physical_memory_manage_check(void) {
     assert(pp2 && pp2 != pp1 && pp2 != pp0);
 
     // temporarily steal the rest of the free pages
-    fl = page_free_list;
-    // now this page_free list must be empty!!!!
-    LIST_INIT(&page_free_list);
+    page_steal_free(&fl);
+    // now every page_free_list must be empty!!!!
     // should be no free memory
     assert(page_alloc(&pp) == -E_NO_MEM);
 
@@ -590,7 +1036,7 @@ void physical_memory_manage_check(void) {
     // pp0 should be zero
     assert(*temp == 0);
 
-    page_free_list = fl;
+    page_return_free(&fl);
     page_free(pp0);
     page_free(pp1);
     page_free(pp2);
@@ -656,9 +1102,8 @@ void page_check(void) {
     assert(pp2 && pp2 != pp1 && pp2 != pp0);
 
     // temporarily steal the rest of the free pages
-    fl = page_free_list;
-    // now this page_free list must be empty!!!!
-    LIST_INIT(&page_free_list);
+    page_steal_free(&fl);
+    // now every page_free_list must be empty!!!!
 
     // should be no free memory
     assert(page_alloc(&pp) == -E_NO_MEM);
@@ -740,7 +1185,7 @@ void page_check(void) {
     pp0->pp_ref = 0;
 
     // give free list back
-    page_free_list = fl;
+    page_return_free(&fl);
 
     // free the pages we took
     page_free(pp0);
@@ -750,9 +1195,15 @@ void page_check(void) {
     printf("page_check() succeeded!\n");
 }
 
-void pageout(int va, int context) {
+/*Overview:
+        Demand paging from do_refill: `va` has no valid mapping in the page
+        directory `context`. A swapped-out page is read back in. Otherwise a
+        read only gets the shared zero page; a write gets a page of its own.
+        Threads of a group share `context`, so every one of them sees it.*/
+void pageout(int va, int context, int cause) {
     u_long r;
     struct Page *p = NULL;
+    Pte *pte;
 
     if (context < 0x80000000) {
         panic("tlb refill and alloc error!");
@@ -766,17 +1217,30 @@ void pageout(int va, int context) {
         panic("^^^^^^TOO LOW^^^^^^^^^");
     }
 
+    if (pgdir_walk((Pde *)context, va, 0, &pte) == 0 && pte != 0 && (*pte & PTE_SWAP)) {
+        if (swap_in((Pde *)context, va, pte) < 0) {
+            panic ("page alloc error!");
+        }
+        return;
+    }
+
+    if (((cause >> 2) & 0x1f) == 2) {
+        // TLBL: a load or an instruction fetch
+        if (page_insert_zero((Pde *)context, VA2PFN(va)) < 0) {
+            panic ("page alloc error!");
+        }
+        return;
+    }
+
     if ((r = page_alloc(&p)) < 0) {
         panic ("page alloc error!");
     }
 
-    p->pp_ref++;
+#ifdef DEBUG
     printf("pageout:\t@@@___0x%x___@@@  ins a page \n", va);
+#endif
         va = VA2PFN(va);
     page_insert((Pde *)context, p, va, PTE_R);
-        if (va > UTEXT) {
-                env_libpage(va);
-        }
 }
 
 
@@ -0,0 +1,251 @@
+/*
+ * Slab allocator for small kernel objects.
+ *
+ * A slab is one page: a struct Slab, the free list as an array of object
+ * indices, the colour padding and then the objects. Keeping the free list
+ * outside the objects leaves constructed objects intact while they are
+ * free. kfree finds the slab of an object by rounding it down to its page.
+ *
+ * kmalloc serves sizes up to 1 << KMEM_MAX_SHIFT from power-of-two caches
+ * and anything bigger from page_alloc_order; such blocks are page aligned,
+ * which no slab object is.
+ */
+
+#include "mmu.h"
+#include "pmap.h"
+#include "slab.h"
+#include "printf.h"
+#include "error.h"
+
+struct Slab {
+        LIST_ENTRY(Slab) sl_link;
+        struct kmem_cache *sl_cache;
+        void *sl_mem;                   // first object, after the colour
+        u_short sl_free;                // index of the first free object
+        u_short sl_inuse;               // objects handed out
+};
+
+/* the free list: entry i holds the index of the free object after i */
+#define SLAB_NEXT(sl)   ((u_short *)((sl) + 1))
+
+static struct kmem_cache kmem_cache_cache;      // where caches come from
+static LIST_HEAD(, kmem_cache) kmem_caches;
+static struct kmem_cache *kmalloc_caches[KMEM_MAX_SHIFT - KMEM_MIN_SHIFT + 1];
+static const char *kmalloc_names[KMEM_MAX_SHIFT - KMEM_MIN_SHIFT + 1] = {
+        "kmalloc-16", "kmalloc-32", "kmalloc-64", "kmalloc-128",
+        "kmalloc-256", "kmalloc-512", "kmalloc-1024", "kmalloc-2048",
+};
+
+static void kmem_cache_setup(struct kmem_cache *kc, const char *name, u_int size, void (*ctor)(void *)) {
+        u_int num;
+
+        size = ROUND(size, KMEM_ALIGN);
+        num = (BY2PG - sizeof(struct Slab)) / (size + sizeof(u_short));
+        while (num > 0 && ROUND(sizeof(struct Slab) + num * sizeof(u_short), KMEM_ALIGN) + num * size > BY2PG) {
+                num--;
+        }
+        if (num == 0) {
+                panic("kmem_cache_setup: %s objects of %d bytes do not fit in a slab", name, size);
+        }
+
+        bzero(kc, sizeof(*kc));
+        kc->kc_name = name;
+        kc->kc_size = size;
+        kc->kc_num = num;
+        kc->kc_offset = ROUND(sizeof(struct Slab) + num * sizeof(u_short), KMEM_ALIGN);
+        kc->kc_colour_max = BY2PG - kc->kc_offset - num * size;
+        kc->kc_ctor = ctor;
+        LIST_INIT(&kc->kc_full);
+        LIST_INIT(&kc->kc_partial);
+        LIST_INIT(&kc->kc_empty);
+        LIST_INSERT_HEAD(&kmem_caches, kc, kc_link);
+}
+
+/* Overview:
+ *      Add a slab to the empty list of `kc`, with every object constructed.
+ *
+ * Post-Condition:
+ *      Return 0 on success, -E_NO_MEM if no page is left.
+ */
+static int kmem_cache_grow(struct kmem_cache *kc) {
+        struct Page *pp;
+        struct Slab *sl;
+        u_int i;
+        int r;
+
+        if ((r = page_alloc_nozero(&pp)) < 0) {
+                return r;
+        }
+        // held like any other kernel page, so nothing takes it for free
+        pp->pp_ref++;
+        sl = (struct Slab *)page2kva(pp);
+        sl->sl_cache = kc;
+        sl->sl_mem = (void *)sl + kc->kc_offset + kc->kc_colour_next;
+        sl->sl_free = 0;
+        sl->sl_inuse = 0;
+        for (i = 0; i < kc->kc_num; i++) {
+                SLAB_NEXT(sl)[i] = i + 1;
+                if (kc->kc_ctor) {
+                        kc->kc_ctor(sl->sl_mem + i * kc->kc_size);
+                }
+        }
+
+        kc->kc_colour_next += KMEM_ALIGN;
+        if (kc->kc_colour_next > kc->kc_colour_max) {
+                kc->kc_colour_next = 0;
+        }
+        LIST_INSERT_HEAD(&kc->kc_empty, sl, sl_link);
+        kc->kc_slabs++;
+        kc->kc_grows++;
+        return 0;
+}
+
+// Overview:
+//      Set up the cache of caches and the kmalloc size classes.
+void kmem_init(void) {
+        u_int shift;
+        const char *name;
+
+        LIST_INIT(&kmem_caches);
+        kmem_cache_setup(&kmem_cache_cache, "kmem_cache", sizeof(struct kmem_cache), NULL);
+        for (shift = KMEM_MIN_SHIFT; shift <= KMEM_MAX_SHIFT; shift++) {
+                name = kmalloc_names[shift - KMEM_MIN_SHIFT];
+                if ((kmalloc_caches[shift - KMEM_MIN_SHIFT] = kmem_cache_create(name, 1 << shift, NULL)) == NULL) {
+                        panic("kmem_init: no memory for %s", name);
+                }
+        }
+}
+
+/* Overview:
+ *      Create a cache of objects of `size` bytes. `ctor`, if not NULL, is
+ * run on every object once, when its slab is allocated; objects must be
+ * returned to the constructed state before they are freed.
+ *
+ * Post-Condition:
+ *      Return the new cache, or NULL if no memory is left.
+ */
+struct kmem_cache *kmem_cache_create(const char *name, u_int size, void (*ctor)(void *)) {
+        struct kmem_cache *kc;
+
+        if ((kc = kmem_cache_alloc(&kmem_cache_cache)) == NULL) {
+                return NULL;
+        }
+        kmem_cache_setup(kc, name, size, ctor);
+        return kc;
+}
+
+/* Overview:
+ *      Allocate an object from `kc`, preferring partially used slabs.
+ *
+ * Post-Condition:
+ *      Return the object, or NULL if no memory is left.
+ */
+void *kmem_cache_alloc(struct kmem_cache *kc) {
+        struct Slab *sl;
+        void *obj;
+
+        if ((sl = LIST_FIRST(&kc->kc_partial)) == NULL) {
+                if (LIST_EMPTY(&kc->kc_empty) && kmem_cache_grow(kc) < 0) {
+                        return NULL;
+                }
+                sl = LIST_FIRST(&kc->kc_empty);
+                LIST_REMOVE(sl, sl_link);
+                LIST_INSERT_HEAD(&kc->kc_partial, sl, sl_link);
+        }
+
+        obj = sl->sl_mem + sl->sl_free * kc->kc_size;
+        sl->sl_free = SLAB_NEXT(sl)[sl->sl_free];
+        if (++sl->sl_inuse == kc->kc_num) {
+                LIST_REMOVE(sl, sl_link);
+                LIST_INSERT_HEAD(&kc->kc_full, sl, sl_link);
+        }
+        kc->kc_allocs++;
+        kc->kc_inuse++;
+        return obj;
+}
+
+/* Overview:
+ *      Give `obj` back to `kc`. A slab that becomes empty is kept if the
+ * cache has no other empty slab, and returned to the page allocator
+ * otherwise.
+ */
+void kmem_cache_free(struct kmem_cache *kc, void *obj) {
+        struct Slab *sl = (struct Slab *)ROUNDDOWN(obj, BY2PG);
+        u_int i;
+
+        if (sl->sl_cache != kc) {
+                panic("kmem_cache_free: %x is not from cache %s", obj, kc->kc_name);
+        }
+        i = (obj - sl->sl_mem) / kc->kc_size;
+        SLAB_NEXT(sl)[i] = sl->sl_free;
+        sl->sl_free = i;
+        kc->kc_frees++;
+        kc->kc_inuse--;
+
+        LIST_REMOVE(sl, sl_link);
+        if (--sl->sl_inuse > 0) {
+                LIST_INSERT_HEAD(&kc->kc_partial, sl, sl_link);
+        } else if (LIST_EMPTY(&kc->kc_empty)) {
+                LIST_INSERT_HEAD(&kc->kc_empty, sl, sl_link);
+        } else {
+                page_decref(pa2page(PADDR(sl)));
+                kc->kc_slabs--;
+        }
+}
+
+/* Overview:
+ *      Allocate `size` bytes of kernel memory, KMEM_ALIGN aligned.
+ *
+ * Post-Condition:
+ *      Return the memory, or NULL if no memory is left.
+ */
+void *kmalloc(u_int size) {
+        struct Page *pp;
+        u_int shift, i;
+
+        if (size > (1 << KMEM_MAX_SHIFT)) {
+                for (shift = 0; (BY2PG << shift) < size; shift++);
+                if (page_alloc_order(shift, &pp) < 0) {
+                        return NULL;
+                }
+                for (i = 0; i < (1 << shift); i++) {
+                        pp[i].pp_ref++;
+                }
+                pp->pp_order = shift;
+                return (void *)page2kva(pp);
+        }
+        for (shift = KMEM_MIN_SHIFT; (1 << shift) < size; shift++);
+        return kmem_cache_alloc(kmalloc_caches[shift - KMEM_MIN_SHIFT]);
+}
+
+// Overview:
+//      Free memory from kmalloc. kfree(NULL) does nothing.
+void kfree(void *obj) {
+        struct Page *pp;
+        u_int i, n;
+
+        if (obj == NULL) {
+                return;
+        }
+        if (ROUNDDOWN(obj, BY2PG) == (u_long)obj) {
+                pp = pa2page(PADDR(obj));
+                n = 1 << pp->pp_order;
+                for (i = 0; i < n; i++) {
+                        page_decref(pp + i);
+                }
+                return;
+        }
+        kmem_cache_free(((struct Slab *)ROUNDDOWN(obj, BY2PG))->sl_cache, obj);
+}
+
+// Overview:
+//      Print the statistics of every cache.
+void kmem_stat(void) {
+        struct kmem_cache *kc;
+
+        printf("cache          size  objs/slab  slabs   inuse   allocs    frees\n");
+        LIST_FOREACH(kc, &kmem_caches, kc_link) {
+                printf("%-14s %4d  %9d  %5d  %6d  %7d  %7d\n", kc->kc_name, kc->kc_size,
+                                kc->kc_num, kc->kc_slabs, kc->kc_inuse, kc->kc_allocs, kc->kc_frees);
+        }
+}
@@ -0,0 +1,167 @@
+/*
+ * Swapping user pages out to the second IDE disk.
+ *
+ * A swapped-out page leaves behind a page table entry without PTE_V but
+ * with PTE_SWAP, whose PFN field holds the swap slot and whose low bits
+ * keep the old permission. The refill path sees it as a missing page and
+ * pageout brings it back with swap_in.
+ *
+ * Victims are chosen by a clock over pages[]. The R3000 keeps no
+ * reference bits, so swap_sample marks the pages found in the TLB every
+ * SWAP_SAMPLE ticks, and the clock passes over a marked page once.
+ */
+
+#include "mmu.h"
+#include "pmap.h"
+#include "env.h"
+#include "swap.h"
+#include "ide.h"
+#include "printf.h"
+#include "error.h"
+
+static u_int swap_map[SWAP_NSLOT / 32];         /* bit set: slot in use */
+static u_int swap_hand;                         /* clock hand into pages[] */
+
+u_int swap_outs = 0;            /* pages written to swap */
+u_int swap_ins = 0;             /* pages read back */
+
+/* Read or write the page at `buf` from or to swap slot `slot`. */
+static void swap_rw(u_int slot, void *buf, int write) {
+        if (ide_rw(SWAP_DISKNO, slot * (BY2PG / IDE_SECT), buf, BY2PG / IDE_SECT, write) < 0) {
+                panic("swap_rw: ide %s failed at slot %d", write ? "write" : "read", slot);
+        }
+}
+
+static int swap_slot_alloc(void) {
+        u_int i, j;
+
+        for (i = 0; i < SWAP_NSLOT / 32; i++) {
+                if (swap_map[i] == ~0) {
+                        continue;
+                }
+                for (j = 0; swap_map[i] & (1 << j); j++);
+                swap_map[i] |= 1 << j;
+                return i * 32 + j;
+        }
+        return -E_NO_MEM;
+}
+
+// Overview:
+//      Release the swap slot of the swapped-out entry `pte`.
+void swap_free(Pte pte) {
+        u_int slot = PPN(pte);
+
+        swap_map[slot / 32] &= ~(1 << (slot % 32));
+}
+
+/* Overview:
+ *      Return the page table entry mapping `pp` if the page may be swapped
+ * out, or NULL: it must have a single mapping, the last one made, in the
+ * address space of a live env, that is neither shared nor a file server
+ * cache block. pp_pgdir is only trusted once the env its page directory
+ * names still uses it.
+ */
+static Pte *swap_victim(struct Page *pp) {
+        struct Page *pd;
+        struct Env *e;
+        Pte *pte;
+
+        if (pp->pp_ref != 1 || pp->pp_free || pp->pp_pgdir == NULL || pp == zero_page) {
+                return NULL;
+        }
+        pd = pa2page(PADDR(pp->pp_pgdir));
+        if (pd->pp_envid == 0) {
+                return NULL;
+        }
+        e = ENV_SLOT(ENVX(pd->pp_envid));
+        if (e->env_id != pd->pp_envid || e->env_status == ENV_FREE || e->env_pgdir != pp->pp_pgdir) {
+                return NULL;
+        }
+        pgdir_walk(pp->pp_pgdir, pp->pp_va, 0, &pte);
+        if (pte == NULL || !(*pte & PTE_V) || PTE_ADDR(*pte) != page2pa(pp)
+                        || (*pte & (PTE_LIBRARY | PTE_D))) {
+                return NULL;
+        }
+        return pte;
+}
+
+/* Overview:
+ *      Write one user page out to swap and free it.
+ *
+ *      Every victim is written, clean or not. The R3000 keeps no dirty
+ * bit, so a page read back from swap would have to stay read-only until
+ * its first write faulted, and every write the kernel makes to a user
+ * page through kseg0 (semaphores, sys_ide_rw buffers) would have to
+ * drop the copy as well. Missing one would bring back stale data, so
+ * swap_in frees the slot instead of keeping it.
+ *
+ * Post-Condition:
+ *      Return 0 on success, -E_NO_MEM if no page could be swapped out.
+ */
+int swap_out(void) {
+        struct Page *pp;
+        Pte *pte;
+        u_int n;
+        int slot;
+
+        for (n = 0; n < 2 * npage; n++) {
+                pp = &pages[swap_hand];
+                swap_hand = (swap_hand + 1) % npage;
+                if ((pte = swap_victim(pp)) == NULL) {
+                        continue;
+                }
+                if (pp->pp_accessed) {
+                        pp->pp_accessed = 0;
+                        continue;
+                }
+                if ((slot = swap_slot_alloc()) < 0) {
+                        return slot;
+                }
+                swap_rw(slot, (void *)page2kva(pp), 1);
+                *pte = (slot << PGSHIFT) | (*pte & 0xfff & ~PTE_V) | PTE_SWAP;
+                tlb_invalidate(pp->pp_pgdir, pp->pp_va);
+                pp->pp_pgdir = NULL;
+                page_decref(pp);
+                swap_outs++;
+                return 0;
+        }
+        return -E_NO_MEM;
+}
+
+/* Overview:
+ *      Bring back the page swapped out at `va` in `pgdir`; `pte` is its
+ * page table entry.
+ *
+ * Post-Condition:
+ *      Return 0 on success, -E_NO_MEM if no page could be allocated.
+ */
+int swap_in(Pde *pgdir, u_long va, Pte *pte) {
+        struct Page *pp;
+        int r;
+
+        if ((r = page_alloc_nozero(&pp)) < 0) {
+                return r;
+        }
+        swap_rw(PPN(*pte), (void *)page2kva(pp), 0);
+        swap_free(*pte);
+        *pte = page2pa(pp) | (*pte & 0xfff & ~PTE_SWAP) | PTE_V;
+        pp->pp_ref++;
+        pp->pp_accessed = 1;
+        pp->pp_pgdir = pgdir;
+        pp->pp_va = ROUNDDOWN(va, BY2PG);
+        swap_ins++;
+        return 0;
+}
+
+// Overview:
+//      Mark the pages currently in the TLB as recently used.
+void swap_sample(void) {
+        u_int i, lo;
+
+        for (i = 0; i < NTLB; i++) {
+                lo = tlb_read_lo(i);
+                if ((lo & PTE_V) && PPN(lo) < npage) {
+                        pages[PPN(lo)].pp_accessed = 1;
+                }
+        }
+}
@@ -122,8 +122,8 @@ void close_all(void) {
 }
 
 int dup(int oldfdnum, int newfdnum) {
-        int i, r;
-        u_int ova, nva, pte;
+        int r;
+        u_int ova, nva;
         struct Fd *oldfd, *newfd;
 
         if ((r = fd_lookup(oldfdnum, &oldfd)) < 0) {
@@ -136,15 +136,8 @@ int dup(int oldfdnum, int newfdnum) {
         nva = fd2data(newfd);
 
         if ((* vpd)[PDX(ova)]) {
-                for (i = 0; i < PDMAP; i += BY2PG) {
-                        pte = (* vpt)[VPN(ova + i)];
-
-                        if (pte & PTE_V) {
-                                // should be no error here -- pd is already allocated
-                                if ((r = syscall_mem_map(0, ova + i, 0, nva + i, pte & (PTE_V | PTE_R | PTE_LIBRARY))) < 0) {
-                                        goto err;
-                                }
-                        }
+                if ((r = syscall_mem_map_range(0, ova, 0, nva, PDMAP / BY2PG)) < 0) {
+                        goto err;
                 }
         }
 
@@ -157,9 +150,7 @@ int dup(int oldfdnum, int newfdnum) {
 err:
         syscall_mem_unmap(0, (u_int)newfd);
 
-        for (i = 0; i < PDMAP; i += BY2PG) {
-                syscall_mem_unmap(0, nva + i);
-        }
+        syscall_mem_unmap_range(0, nva, PDMAP / BY2PG);
 
         return r;
 }
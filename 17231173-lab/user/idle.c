@@ -1,7 +0,0 @@
-#include "lib.h"
-
-void umain() {
-        while(1)
-                writef("IDLE!");
-}
-
@@ -10,12 +10,12 @@ extern struct Env *env;
 // it succeeds.  It should panic() on any error other than
 // -E_IPC_NOT_RECV.
 //
-// Hint: use syscall_yield() to be CPU-friendly.
+// Hint: yield to `whom` so that it gets to ipc_recv sooner.
 void ipc_send(u_int whom, u_int val, u_int srcva, u_int perm) {
         int r;
 
         while ((r=syscall_ipc_can_send(whom, val, srcva, perm)) == -E_IPC_NOT_RECV) {
-                syscall_yield();
+                syscall_yield_to(whom);
                 //writef("QQ");
         }
         if(r == 0) return;
@@ -35,4 +35,18 @@ u_int ipc_recv(u_int *whom, u_int dstva, u_int *perm) {
         return env->env_ipc_value;
 }
 
+// Like ipc_recv, but give up after `ticks` timer ticks. The value is
+// stored in *val. Return 0 on success, -E_TIMEOUT if nothing arrived.
+int ipc_recv_timeout(u_int *whom, u_int dstva, u_int *perm, u_int *val, u_int ticks) {
+        int r;
+
+        if ((r = syscall_ipc_recv_timeout(dstva, ticks)) < 0) {
+                return r;
+        }
+        if (whom) *whom = env->env_ipc_from;
+        if (perm) *perm = env->env_ipc_perm;
+        if (val) *val = env->env_ipc_value;
+        return 0;
+}
+
 
@@ -17,6 +17,15 @@ extern void exit();
 
 extern struct Env *env;
 extern struct Env **thread;
+extern struct Tcb *tcb;         // our thread group, once env->env_tcb is set
+
+/* How thread i of our group exited, thread 0 being the leader. The Tcb is
+ * read-only, so the threads keep this in a page of their own at UTCBEXIT. */
+struct Tcb_exit {
+        void *retval;
+        int dead;
+};
+extern struct Tcb_exit *tcb_exit;
 extern sem_t *sems;
 
 #define USED(x) (void)(x)
@@ -52,23 +61,46 @@ void syscall_putchar(char ch);
 u_int syscall_getenvid(void);
 u_int syscall_getthreadid(void);
 void syscall_yield(void);
+void syscall_yield_to(u_int envid);
 int syscall_env_destroy(u_int envid);
 int syscall_set_pgfault_handler(u_int envid, void (*func)(void),
-                                                                u_int xstacktop);
+                                                                u_int xstacktop, u_int flags);
 int syscall_mem_alloc(u_int envid, u_int va, u_int perm);
+int syscall_mem_alloc_range(u_int envid, u_int va, u_int len, u_int perm);
 int syscall_mem_map(u_int srcid, u_int srcva, u_int dstid, u_int dstva,
                                         u_int perm);
 int syscall_mem_unmap(u_int envid, u_int va);
+int syscall_mem_map_range(u_int srcid, u_int srcva, u_int dstid, u_int dstva,
+                                        u_int npages);
+int syscall_mem_unmap_range(u_int envid, u_int va, u_int npages);
+int syscall_shm_get(u_int key, u_int size, int create);
+int syscall_shm_attach(u_int id, u_int va, u_int perm);
+int syscall_shm_detach(u_int id, u_int va);
+int syscall_shm_remove(u_int id);
+int syscall_ide_rw(u_int diskno, u_int secno, u_int va, u_int nsect, int write);
+void syscall_kmem_stat(void);
 
 inline static int syscall_env_alloc(void) {
     return msyscall(SYS_env_alloc, 0, 0, 0, 0, 0);
 }
 
+inline static int syscall_fork(void) {
+    return msyscall(SYS_fork, 0, 0, 0, 0, 0);
+}
+
+inline static int syscall_thread_alloc(void) {
+    return msyscall(SYS_thread_alloc, 0, 0, 0, 0, 0);
+}
+
 int syscall_set_env_status(u_int envid, u_int status);
 int syscall_set_trapframe(u_int envid, struct Trapframe *tf);
 void syscall_panic(char *msg);
 int syscall_ipc_can_send(u_int envid, u_int value, u_int srcva, u_int perm);
 void syscall_ipc_recv(u_int dstva);
+int syscall_ipc_recv_timeout(u_int dstva, u_int ticks);
+void syscall_sleep(u_int ticks);
+int syscall_set_priority(u_int envid, u_int pri, u_int quantum);
+int syscall_set_edf(u_int envid, u_int period, u_int budget);
 int syscall_cgetc();
 int syscall_write_dev(u_int va,u_int dev,u_int offset);
 int syscall_read_dev(u_int va,u_int dev,u_int offset);
@@ -83,6 +115,7 @@ int strcmp(const char *p, const char *q);
 // ipc.c
 void ipc_send(u_int whom, u_int val, u_int srcva, u_int perm);
 u_int ipc_recv(u_int *whom, u_int dstva, u_int *perm);
+int ipc_recv_timeout(u_int *whom, u_int dstva, u_int *perm, u_int *val, u_int ticks);
 
 // wait.c
 void wait(u_int envid);
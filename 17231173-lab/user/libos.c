@@ -4,6 +4,8 @@
 
 struct Env *env;
 struct Env **thread = (struct Env **) UTHREAD;
+struct Tcb *tcb = (struct Tcb *) UTCB;
+struct Tcb_exit *tcb_exit = (struct Tcb_exit *) UTCBEXIT;
 
 void exit(void) {
         //close_all();
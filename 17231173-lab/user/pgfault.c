@@ -23,7 +23,7 @@ set_pgfault_handler(void (*fn)(u_int va))
                 // map one page of exception stack with top at UXSTACKTOP
                 // register assembly handler and stack with operating system
                 if (syscall_mem_alloc(0, UXSTACKTOP - BY2PG, PTE_V | PTE_R) < 0 ||
-                        syscall_set_pgfault_handler(0, __asm_pgfault_handler, UXSTACKTOP) < 0) {
+                        syscall_set_pgfault_handler(0, __asm_pgfault_handler, UXSTACKTOP, 0) < 0) {
                         writef("cannot set pgfault handler\n");
                         return;
                 }
@@ -9,6 +9,23 @@
 
 // #define DPOSIX
 
+/* env of thread `th` of our group; thread 0 is the leader */
+static struct Env *pthread_env(pthread_t th) {
+        return th == 0 ? env : envs + ENVX(tcb->tcb_children[th - 1]);
+}
+
+/* number of thread `e` in our group */
+static pthread_t pthread_index(struct Env *e) {
+        u_int i;
+
+        for (i = 0; env->env_tcb != NULL && i < tcb->tcb_cnum; i++) {
+                if (tcb->tcb_children[i] == e->env_id) {
+                        return i + 1;
+                }
+        }
+        return 0;
+}
+
 static void thread_wrapper(void *(*start_routine)(void *), void *arg, u_int envid) {
         void *retval;
         *thread = envs + ENVX(envid);
@@ -35,23 +52,22 @@ int pthread_create(pthread_t *newthread, const pthread_attr_t *attr, void *(*sta
         if (attr != NULL) {
                 user_panic("pthread_create@pthread.c: pthread_attr not implemented\n");
         }
-        u_int newthreadid = sfork((u_int) thread_wrapper, (u_int) start_routine, (u_int) arg, USTACKTOP - PDMAP * (env->tcb_cnum + 1));
-        u_int i;
-        for (i = 0; i < env->tcb_cnum; i++) {
-                if (env->tcb_children[i]->env_id == newthreadid) {
-                        *newthread = i + 1;
-                }
-        }
+        u_int cnum = env->env_tcb == NULL ? 0 : tcb->tcb_cnum;
+        u_int newthreadid = sfork((u_int) thread_wrapper, (u_int) start_routine, (u_int) arg, USTACKTOP - PDMAP * (cnum + 1));
+        *newthread = pthread_index(envs + ENVX(newthreadid));
         return 0;
 }
 
-static void pexit(struct Env *e, void *retval) {
+static void pexit(pthread_t th, void *retval) {
+        struct Env *e = pthread_env(th);
         int i;
-        e->retval = retval;
-        e->dead = 1;
-        if (e->tcb_super == NULL) {
+        if (env->env_tcb != NULL) {
+                tcb_exit[th].retval = retval;
+                tcb_exit[th].dead = 1;
+        }
+        if (th == 0) {
                 writef("pexit@pthread.c: this thread is not child\n");
-                for (i = 0; i < e->tcb_cnum; i++) {
+                for (i = 0; env->env_tcb != NULL && i < tcb->tcb_cnum; i++) {
                         pthread_join(i + 1, NULL);
                 }
                 syscall_env_destroy(e->env_id);
@@ -76,7 +92,7 @@ void pthread_exit(void *retval) {
 #ifdef DPOSIX
         writef("pthread_exit@pthread.c called with (void *retval: %x)\n", retval);
 #endif
-        pexit(*thread, retval);
+        pexit(pthread_index(*thread), retval);
 }
 
 /* join with a terminated thread
@@ -90,15 +106,18 @@ int pthread_join(pthread_t th, void **thread_return) {
 #ifdef DPOSIX
         writef("pthread_join@pthread.c called with (pthread_t th: %x, void **thread_return: %x) %x\n", th, thread_return, env);
 #endif
-        struct Env *e = th == 0 ? env : env->tcb_children[th-1];
+        if (env->env_tcb == NULL) {
+                user_panic("pthread_join@pthread.c: no thread to join\n");
+        }
+        struct Env *e = pthread_env(th);
 #ifdef DPOSIX
-        writef("pthread_join@pthread.c: fetched coresponding thread %x, dead=%d\n", e, e->dead);
+        writef("pthread_join@pthread.c: fetched coresponding thread %x, dead=%d\n", e, tcb_exit[th].dead);
 #endif
-        while (e->dead == 0) {
-                syscall_yield();
+        while (tcb_exit[th].dead == 0) {
+                syscall_yield_to(e->env_id);
         }
         if (thread_return != NULL) {
-                *thread_return = e->retval;
+                *thread_return = tcb_exit[th].retval;
 #ifdef DPOSIX
                 writef("pthread_join@pthread.c: thread %x ended with %x\n", th, *thread_return);
 #endif
@@ -116,11 +135,7 @@ int pthread_cancel(pthread_t th) {
 #ifdef DPOSIX
         writef("pthread_cancel@pthread.c called with (pthread_t th: %x)\n", th);
 #endif
-        if (th == 0) {
-                pexit(env, NULL);
-        } else {
-                pexit(env->tcb_children[th-1], NULL);
-        }
+        pexit(th, NULL);
         return 0;
 }
 
@@ -24,6 +24,11 @@ int sem_wait(sem_t *sem) {
         return 0;
 }
 
+/* wait at most `ticks` timer ticks; return -E_TIMEOUT if that ran out */
+int sem_timedwait(sem_t *sem, u_int ticks) {
+        return msyscall(SYS_sem_timedwait, (u_int) sem, ticks, 0, 0, 0);
+}
+
 int sem_trywait(sem_t *sem) {
  #ifdef DPOSIX
         writef("sem_trywait@semaphore.c called with (sem_t *sem: %x)\n", sem);
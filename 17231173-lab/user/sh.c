@@ -71,6 +71,51 @@ int gettoken(char *s, char **p1) {
 }
 
 #define MAXARGS 16
+#define NICE_DEFAULT 4        // levels `nice` lowers a job by default
+
+static int atoi(char *s) {
+        int n = 0, neg = 0;
+
+        if (*s == '-') {
+                neg = 1;
+                s++;
+        }
+        while (*s >= '0' && *s <= '9')
+                n = n * 10 + *s++ - '0';
+        return neg ? -n : n;
+}
+
+// nice [-n incr] command...
+// Move this shell child `incr` run queue levels down, so the command
+// spawned next inherits the lower priority. Inside the MLFQ levels the
+// feedback and the periodic boost would soon undo the change, so a
+// niced job is moved past them. Returns the number of words to skip in
+// argv, or -1 on a usage error.
+static int nice(int argc, char **argv) {
+        int incr = NICE_DEFAULT, skip = 1, level, r;
+
+        if (argc > 2 && strcmp(argv[1], "-n") == 0) {
+                incr = atoi(argv[2]);
+                skip = 3;
+        }
+        if (argc <= skip) {
+                writef("usage: nice [-n incr] command...\n");
+                return -1;
+        }
+        level = env->env_level + incr;
+        if (incr > 0 && level <= SCHED_MLFQ_BOTTOM)
+                level = SCHED_MLFQ_BOTTOM + 1;
+        if (incr < 0 && level >= SCHED_MLFQ_TOP)
+                level = SCHED_MLFQ_TOP - 1;
+        if (level < 0)
+                level = 0;
+        if (level >= SCHED_NPRI)
+                level = SCHED_NPRI - 1;
+        if ((r = syscall_set_priority(0, level, 0)) < 0)
+                writef("nice: %e\n", r);
+        return skip;
+}
+
 void runcmd(char *s) {
         char *argv[MAXARGS], *t;
         int argc, c, i, r, p[2], fd, rightpipe;
@@ -136,6 +181,13 @@ runit:
                 return;
         }
         argv[argc] = 0;
+        if (strcmp(argv[0], "nice") == 0) {
+                if ((r = nice(argc, argv)) < 0)
+                        exit();
+                for (i = 0; i + r <= argc; i++)
+                        argv[i] = argv[i + r];
+                argc -= r;
+        }
         if (1) {
                 writef("[%08x] SPAWN:", env->env_id);
                 for (i = 0; argv[i]; i++)
@@ -106,12 +106,9 @@ static int usr_load_elf_mapper(int fd, Elf32_Phdr *ph, int child_envid) {
                 syscall_mem_map(0, tmp, child_envid, va + i, PTE_V|PTE_R);
                 syscall_mem_unmap(0, tmp);
         }
-        for (; i < ph->p_memsz; i += BY2PG) {
-                syscall_mem_alloc(0, tmp, PTE_V|PTE_R);
-                user_bzero((void *) tmp, BY2PG);
-                syscall_mem_map(0, tmp, child_envid, va + i, PTE_V|PTE_R);
-                syscall_mem_unmap(0, tmp);
-        }
+        // The rest up to p_memsz is bss. It is left unmapped: the child's
+        // first read of a page maps the shared zero page, its first write a
+        // fresh cleared page.
         return 0;
 }
 
@@ -20,22 +20,62 @@ void syscall_yield(void) {
         msyscall(SYS_yield, 0, 0, 0, 0, 0);
 }
 
+void syscall_yield_to(u_int envid) {
+        msyscall(SYS_yield_to, envid, 0, 0, 0, 0);
+}
+
 int syscall_env_destroy(u_int envid) {
         return msyscall(SYS_env_destroy, envid, 0, 0, 0, 0);
 }
 
-int syscall_set_pgfault_handler(u_int envid, void (*func)(void), u_int xstacktop) {
-        return msyscall(SYS_set_pgfault_handler, envid, (int)func, xstacktop, 0, 0);
+int syscall_set_pgfault_handler(u_int envid, void (*func)(void), u_int xstacktop, u_int flags) {
+        return msyscall(SYS_set_pgfault_handler, envid, (int)func, xstacktop, flags, 0);
 }
 
 int syscall_mem_alloc(u_int envid, u_int va, u_int perm) {
         return msyscall(SYS_mem_alloc, envid, va, perm, 0, 0);
 }
 
+int syscall_mem_alloc_range(u_int envid, u_int va, u_int len, u_int perm) {
+        return msyscall(SYS_mem_alloc_range, envid, va, len, perm, 0);
+}
+
 int syscall_mem_map(u_int srcid, u_int srcva, u_int dstid, u_int dstva, u_int perm) {
         return msyscall(SYS_mem_map, srcid, srcva, dstid, dstva, perm);
 }
 
+int syscall_mem_map_range(u_int srcid, u_int srcva, u_int dstid, u_int dstva, u_int npages) {
+        return msyscall(SYS_mem_map_range, srcid, srcva, dstid, dstva, npages);
+}
+
+int syscall_mem_unmap_range(u_int envid, u_int va, u_int npages) {
+        return msyscall(SYS_mem_unmap_range, envid, va, npages, 0, 0);
+}
+
+int syscall_shm_get(u_int key, u_int size, int create) {
+        return msyscall(SYS_shm_get, key, size, create, 0, 0);
+}
+
+int syscall_shm_attach(u_int id, u_int va, u_int perm) {
+        return msyscall(SYS_shm_attach, id, va, perm, 0, 0);
+}
+
+int syscall_shm_detach(u_int id, u_int va) {
+        return msyscall(SYS_shm_detach, id, va, 0, 0, 0);
+}
+
+int syscall_shm_remove(u_int id) {
+        return msyscall(SYS_shm_remove, id, 0, 0, 0, 0);
+}
+
+int syscall_ide_rw(u_int diskno, u_int secno, u_int va, u_int nsect, int write) {
+        return msyscall(SYS_ide_rw, diskno, secno, va, nsect, write);
+}
+
+void syscall_kmem_stat(void) {
+        msyscall(SYS_kmem_stat, 0, 0, 0, 0, 0);
+}
+
 int syscall_mem_unmap(u_int envid, u_int va) {
         return msyscall(SYS_mem_unmap, envid, va, 0, 0, 0);
 }
@@ -60,6 +100,22 @@ void syscall_ipc_recv(u_int dstva) {
         msyscall(SYS_ipc_recv, dstva, 0, 0, 0, 0);
 }
 
+int syscall_ipc_recv_timeout(u_int dstva, u_int ticks) {
+        return msyscall(SYS_ipc_recv_timeout, dstva, ticks, 0, 0, 0);
+}
+
+void syscall_sleep(u_int ticks) {
+        msyscall(SYS_sleep, ticks, 0, 0, 0, 0);
+}
+
+int syscall_set_priority(u_int envid, u_int pri, u_int quantum) {
+        return msyscall(SYS_set_priority, envid, pri, quantum, 0, 0);
+}
+
+int syscall_set_edf(u_int envid, u_int period, u_int budget) {
+        return msyscall(SYS_set_edf, envid, period, budget, 0, 0);
+}
+
 int syscall_cgetc() {
         return msyscall(SYS_cgetc, 0, 0, 0, 0, 0);
 }
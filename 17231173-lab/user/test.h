@@ -0,0 +1,31 @@
+#ifndef TEST_H
+#define TEST_H
+
+#include "lib.h"
+
+/* Harness shared by the user test programs. TEST(name) runs test_name()
+ * in a child of its own, so a failed user_assert ends only that test, and
+ * waits for the child before the next test starts. Call TEST_INIT() once
+ * before the first TEST and TEST_OVER() after the last one. Which program
+ * mips_init starts is picked when the kernel is built: make test=testfork */
+
+static sem_t test_done;
+
+#define TEST_INIT() sem_init(&test_done, 1, 0)
+
+#define TEST(name) \
+        do {\
+                if (fork() == 0) { \
+                        writef("\n--------------------------------------------------------------------------------\ntest " #name " begin\n"); \
+                        test_##name(); \
+                        writef("\ntest " #name " passed\n^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^\n"); \
+                        sem_post(&test_done); \
+                        return; \
+                } \
+                sem_wait(&test_done); \
+        } while (0)
+
+#define TEST_OVER(prog) \
+        writef("\n\n########################################################################\n" prog " is over\n\n")
+
+#endif
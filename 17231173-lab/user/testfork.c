@@ -0,0 +1,95 @@
+#include "test.h"
+
+// Copy-on-write isolation after sys_fork: whatever one side writes, the
+// other side keeps seeing its own value.
+
+#define MAGIC 0x1234
+#define MAGIC2 0x5678
+
+static int data = MAGIC;        // .data
+static int bss;                 // .bss, mapped from the zero page
+static sem_t *done;
+
+// data and bss
+static void test_fork_data(void) {
+        int r;
+
+        if ((r = fork()) == 0) {
+                user_assert(data == MAGIC && bss == 0);
+                data = MAGIC2;
+                bss = MAGIC2;
+                user_assert(data == MAGIC2 && bss == MAGIC2);
+                sem_post(done);
+                exit();
+        }
+        user_assert(r > 0);
+        sem_wait(done);
+        user_assert(data == MAGIC && bss == 0);
+        return;
+}
+
+// the parent writes first
+static void test_fork_parent_write(void) {
+        int r, stack = MAGIC;
+
+        if ((r = fork()) == 0) {
+                sem_wait(done);
+                user_assert(stack == MAGIC && data == MAGIC);
+                sem_post(done + 1);
+                exit();
+        }
+        stack = MAGIC2;
+        data = MAGIC2;
+        sem_post(done);
+        sem_wait(done + 1);
+        user_assert(stack == MAGIC2 && data == MAGIC2);
+        data = MAGIC;
+        return;
+}
+
+// a page from syscall_mem_alloc, written by the child
+static void test_fork_alloc_page(void) {
+        u_int va = 0x50000000;
+        int r;
+
+        user_assert(syscall_mem_alloc(0, va, PTE_V | PTE_R) == 0);
+        *(int *) va = MAGIC;
+        if ((r = fork()) == 0) {
+                user_assert(*(int *) va == MAGIC);
+                *(int *) va = MAGIC2;
+                sem_post(done);
+                exit();
+        }
+        sem_wait(done);
+        user_assert(*(int *) va == MAGIC);
+        syscall_mem_unmap(0, va);
+        return;
+}
+
+// sys_fork refuses a thread group, from the leader or a thread
+static void *routine_fork_thread(void *arg) {
+        user_assert(syscall_fork() == -E_INVAL);
+        return NULL;
+}
+
+static void test_fork_thread(void) {
+        pthread_t th;
+
+        user_assert(pthread_create(&th, NULL, routine_fork_thread, NULL) == 0);
+        user_assert(pthread_join(th, NULL) == 0);
+        user_assert(syscall_fork() == -E_INVAL);
+        return;
+}
+
+void umain(void) {
+        sem_t d[2];
+        TEST_INIT();
+        sem_init(d, 1, 0);
+        sem_init(d + 1, 1, 0);
+        done = d;
+        TEST(fork_data);
+        TEST(fork_parent_write);
+        TEST(fork_alloc_page);
+        TEST(fork_thread);
+        TEST_OVER("testfork");
+}
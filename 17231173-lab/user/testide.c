@@ -0,0 +1,74 @@
+#include "test.h"
+
+// syscall_ide_rw: multi-sector transfers straight into a user buffer.
+// Only block 0 of disk 0, which the file system leaves unused, is
+// written, and its old contents are put back.
+
+#define SECT 512
+#define NSECT 8                 // one file system block
+#define BUF 0x50000000          // two pages
+#define BUF2 0x50800000         // two pages
+#define SAVE 0x51000000
+#define RDONLY 0x51800000
+// NSECT sectors starting half way through the sectors of the first page,
+// so that every transfer crosses into the second one
+#define MID(va) ((va) + BY2PG - NSECT / 2 * SECT)
+
+static void alloc(u_int va, u_int npage, u_int perm) {
+        u_int i;
+
+        for (i = 0; i < npage; i++) {
+                user_assert(syscall_mem_alloc(0, va + i * BY2PG, perm) == 0);
+        }
+}
+
+// write a pattern, read it back, in one call each
+static void test_ide_round_trip(void) {
+        u_int *p, *q, i;
+
+        alloc(BUF, 2, PTE_V | PTE_R);
+        alloc(BUF2, 2, PTE_V | PTE_R);
+        alloc(SAVE, 1, PTE_V | PTE_R);
+        user_assert(syscall_ide_rw(0, 0, SAVE, NSECT, 0) == 0);
+
+        p = (u_int *) MID(BUF);
+        for (i = 0; i < NSECT * SECT / 4; i++) {
+                p[i] = i * 0x01010101 + 0x1234;
+        }
+        user_assert(syscall_ide_rw(0, 0, MID(BUF), NSECT, 1) == 0);
+        user_assert(syscall_ide_rw(0, 0, MID(BUF2), NSECT, 0) == 0);
+        q = (u_int *) MID(BUF2);
+        for (i = 0; i < NSECT * SECT / 4; i++) {
+                user_assert(q[i] == p[i]);
+        }
+
+        // a single sector from the middle of the block
+        user_assert(syscall_ide_rw(0, 3, BUF2, 1, 0) == 0);
+        for (i = 0; i < SECT / 4; i++) {
+                user_assert(((u_int *) BUF2)[i] == p[3 * SECT / 4 + i]);
+        }
+
+        user_assert(syscall_ide_rw(0, 0, SAVE, NSECT, 1) == 0);
+        return;
+}
+
+// bad buffers and arguments are refused before the disk is touched
+static void test_ide_inval(void) {
+        alloc(BUF, 2, PTE_V | PTE_R);
+        alloc(RDONLY, 1, PTE_V);
+        user_assert(syscall_ide_rw(0, 0, BUF + 4, 1, 0) == -E_INVAL);
+        user_assert(syscall_ide_rw(0, 0, BUF + SECT / 2, 1, 1) == -E_INVAL);
+        user_assert(syscall_ide_rw(0, 0, BUF, 0, 0) == -E_INVAL);
+        user_assert(syscall_ide_rw(1, 0, BUF, 1, 0) == -E_INVAL);
+        user_assert(syscall_ide_rw(0, 0, UTOP - SECT, 2, 0) == -E_INVAL);
+        user_assert(syscall_ide_rw(0, 0, BUF + BY2PG, NSECT + 1, 0) == -E_INVAL);
+        user_assert(syscall_ide_rw(0, 0, RDONLY, 1, 0) == -E_INVAL);
+        return;
+}
+
+void umain(void) {
+        TEST_INIT();
+        TEST(ide_round_trip);
+        TEST(ide_inval);
+        TEST_OVER("testide");
+}
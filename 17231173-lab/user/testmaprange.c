@@ -0,0 +1,84 @@
+#include "test.h"
+
+// syscall_mem_map_range and syscall_mem_unmap_range.
+
+#define MAGIC 0x1234
+#define MAGIC2 0x5678
+#define SRC 0x50000000
+#define DST 0x50800000
+#define NPAGE 4
+
+static sem_t *done;
+
+static int mapped(u_int va) {
+        return ((*vpt)[VPN(va)] & PTE_V) != 0;
+}
+
+// a private writable source is shared; holes stay holes
+static void test_map_range_shared(void) {
+        int i;
+
+        for (i = 0; i < NPAGE; i++) {
+                user_assert(syscall_mem_alloc(0, SRC + i * BY2PG, PTE_V | PTE_R) == 0);
+                *(int *) (SRC + i * BY2PG) = MAGIC + i;
+        }
+        syscall_mem_unmap(0, SRC + 2 * BY2PG);
+        user_assert(syscall_mem_map_range(0, SRC, 0, DST, NPAGE) == 0);
+        for (i = 0; i < NPAGE; i++) {
+                if (i == 2) {
+                        user_assert(!mapped(DST + i * BY2PG));
+                        continue;
+                }
+                user_assert(*(int *) (DST + i * BY2PG) == MAGIC + i);
+                *(int *) (DST + i * BY2PG) = MAGIC2;
+                user_assert(*(int *) (SRC + i * BY2PG) == MAGIC2);
+        }
+        user_assert(syscall_mem_unmap_range(0, DST, NPAGE) == 0);
+        for (i = 0; i < NPAGE; i++) {
+                user_assert(!mapped(DST + i * BY2PG));
+        }
+        user_assert(*(int *) SRC == MAGIC2);
+        return;
+}
+
+// a copy-on-write source stays copy-on-write in the new mapping
+static void test_map_range_cow(void) {
+        int r;
+
+        user_assert(syscall_mem_alloc(0, SRC, PTE_V | PTE_R) == 0);
+        *(int *) SRC = MAGIC;
+        if ((r = fork()) == 0) {
+                sem_wait(done);
+                user_assert(*(int *) SRC == MAGIC);
+                sem_post(done + 1);
+                exit();
+        }
+        user_assert(syscall_mem_map_range(0, SRC, 0, DST, 1) == 0);
+        user_assert((*vpt)[VPN(DST)] & PTE_COW);
+        *(int *) DST = MAGIC2;
+        user_assert(*(int *) DST == MAGIC2);
+        user_assert(*(int *) SRC == MAGIC);
+        sem_post(done);
+        sem_wait(done + 1);
+        return;
+}
+
+// bad arguments
+static void test_map_range_inval(void) {
+        user_assert(syscall_mem_map_range(0, SRC + 4, 0, DST, 1) == -E_INVAL);
+        user_assert(syscall_mem_map_range(0, SRC, 0, UTOP - BY2PG, 2) == -E_INVAL);
+        user_assert(syscall_mem_unmap_range(0, UTOP, 1) == -E_INVAL);
+        return;
+}
+
+void umain(void) {
+        sem_t d[2];
+        TEST_INIT();
+        sem_init(d, 1, 0);
+        sem_init(d + 1, 1, 0);
+        done = d;
+        TEST(map_range_shared);
+        TEST(map_range_cow);
+        TEST(map_range_inval);
+        TEST_OVER("testmaprange");
+}
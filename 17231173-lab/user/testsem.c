@@ -5,7 +5,7 @@
     > Created Time: 20190623  14ʱ5511
  ************************************************************************/
 
-#include "lib.h"
+#include "test.h"
 
 // pthread_create
 #define MAGIC ((void *) 123)
@@ -237,30 +237,36 @@ static void test_id(void) {
         return;
 }
 
-#define TEST(name) \
-        do {\
-                if (fork() == 0) { \
-                        writef("\n--------------------------------------------------------------------------------\ntest " #name " begin\n"); \
-                        test_##name(); \
-                        writef("\ntest " #name " passed\n^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^\n"); \
-                        sem_post(&s); \
-                        return; \
-                } \
-                sem_wait(&s); \
-        } while (0)
+// sem_timedwait
+static void *routine_sem_timedwait(void *arg) {
+        sem_t *s = (sem_t *) arg;
+        sem_post(s);
+        return NULL;
+}
 
-void umain(void) {
+static void test_sem_timedwait(void) {
         sem_t s;
-        sem_init(&s, 1, 0);
+        pthread_t th;
+        sem_init(&s, 0, 0);
+        user_assert(sem_timedwait(&s, 1) == -E_TIMEOUT);
+        pthread_create(&th, NULL, routine_sem_timedwait, &s);
+        user_assert(sem_timedwait(&s, 1000) == 0);
+        pthread_join(th, NULL);
+        return;
+}
+
+void umain(void) {
+        TEST_INIT();
         TEST(pthread_create);
         TEST(pthread_join);
         TEST(pthread_exit);
         TEST(pthread_cancel);
         TEST(sem_trywait);
         TEST(sem_destroy);
+        TEST(sem_timedwait);
         TEST(shared_stack);
         TEST(id);
-        writef("\n\n########################################################################\ntest_umain is over\n\n");
+        TEST_OVER("testsem");
 }
 
 
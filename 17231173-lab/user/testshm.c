@@ -0,0 +1,98 @@
+#include "test.h"
+#include <shm.h>
+
+// Shared memory segments: get, attach, fork, detach and remove.
+
+#define MAGIC 0x1234
+#define MAGIC2 0x5678
+#define KEY 42
+#define VA 0x50000000
+#define VA2 0x50800000
+#define NPAGE 3
+
+static sem_t *done;
+
+static int mapped(u_int va) {
+        return ((*vpt)[VPN(va)] & PTE_V) != 0;
+}
+
+// lookup by key
+static void test_shm_get(void) {
+        int id, id2, id3;
+
+        user_assert(syscall_shm_get(KEY, BY2PG, 0) == -E_NOT_FOUND);
+        user_assert((id = syscall_shm_get(KEY, NPAGE * BY2PG, 1)) > 0);
+        user_assert(syscall_shm_get(KEY, BY2PG, 0) == id);
+        user_assert(syscall_shm_get(KEY, NPAGE * BY2PG, 1) == id);
+        user_assert(syscall_shm_get(KEY, (NPAGE + 1) * BY2PG, 0) == -E_INVAL);
+        user_assert((id2 = syscall_shm_get(SHM_PRIVATE, BY2PG, 1)) > 0);
+        user_assert((id3 = syscall_shm_get(SHM_PRIVATE, BY2PG, 1)) > 0);
+        user_assert(id2 != id && id3 != id2);
+        user_assert(syscall_shm_get(KEY + 1, 0, 1) == -E_INVAL);
+        user_assert(syscall_shm_get(KEY + 1, (SHM_MAX_NPAGE + 1) * BY2PG, 1) == -E_INVAL);
+        user_assert(syscall_shm_remove(id) == 0);
+        user_assert(syscall_shm_remove(id2) == 0);
+        user_assert(syscall_shm_remove(id3) == 0);
+        user_assert(syscall_shm_get(KEY, BY2PG, 0) == -E_NOT_FOUND);
+        return;
+}
+
+// a child shares the segment, and may not remove it
+static void test_shm_fork(void) {
+        int id, r, i;
+
+        user_assert((id = syscall_shm_get(SHM_PRIVATE, NPAGE * BY2PG, 1)) > 0);
+        user_assert(syscall_shm_attach(id, VA, PTE_R) == 0);
+        for (i = 0; i < NPAGE; i++) {
+                user_assert(*(int *) (VA + i * BY2PG) == 0);
+                *(int *) (VA + i * BY2PG) = MAGIC + i;
+        }
+        if ((r = fork()) == 0) {
+                for (i = 0; i < NPAGE; i++) {
+                        user_assert(*(int *) (VA + i * BY2PG) == MAGIC + i);
+                }
+                *(int *) VA = MAGIC2;
+                user_assert(syscall_shm_remove(id) == -E_BAD_ENV);
+                user_assert(syscall_shm_detach(id, VA + BY2PG) == -E_INVAL);
+                user_assert(mapped(VA));
+                user_assert(syscall_shm_detach(id, VA) == 0);
+                user_assert(!mapped(VA));
+                sem_post(done);
+                exit();
+        }
+        user_assert(r > 0);
+        sem_wait(done);
+        user_assert(*(int *) VA == MAGIC2);
+        user_assert(syscall_shm_detach(id, VA) == 0);
+        user_assert(syscall_shm_remove(id) == 0);
+        return;
+}
+
+// attached twice; the pages outlive the removed segment
+static void test_shm_remove(void) {
+        int id;
+
+        user_assert((id = syscall_shm_get(SHM_PRIVATE, BY2PG, 1)) > 0);
+        user_assert(syscall_shm_attach(id, VA, PTE_R) == 0);
+        user_assert(syscall_shm_attach(id, VA2, PTE_R) == 0);
+        *(int *) VA = MAGIC;
+        user_assert(*(int *) VA2 == MAGIC);
+        user_assert(syscall_shm_detach(id, VA) == 0);
+        user_assert(syscall_shm_remove(id) == 0);
+        user_assert(syscall_shm_remove(id) == -E_INVAL);
+        user_assert(syscall_shm_attach(id, VA, PTE_R) == -E_INVAL);
+        user_assert(*(int *) VA2 == MAGIC);
+        syscall_mem_unmap(0, VA2);
+        return;
+}
+
+void umain(void) {
+        sem_t d;
+        TEST_INIT();
+        sem_init(&d, 1, 0);
+        done = &d;
+        TEST(shm_get);
+        TEST(shm_fork);
+        TEST(shm_remove);
+        TEST_OVER("testshm");
+}
@@ -0,0 +1,76 @@
+#include "test.h"
+
+// Demand paging: touch more memory than the machine has, so that pages
+// go out to the swap disk, and check that every one comes back intact.
+
+#define BASE 0x10000000
+#define NPAGE 20480     // 80 MB; gxemul is started with -M 64
+#define PAGE(i) ((u_int *) (BASE + (i) * BY2PG))
+
+static sem_t *done;
+
+static u_int pattern(u_int i) {
+        return (i * 2654435761u) ^ 0x5a5a5a5a;
+}
+
+static int swapped(u_int va) {
+        return ((*vpt)[VPN(va)] & (PTE_V | PTE_SWAP)) == PTE_SWAP;
+}
+
+// fill, count what went out, read everything back
+static void test_swap_round_trip(void) {
+        u_int i, out = 0;
+
+        for (i = 0; i < NPAGE; i++) {
+                user_assert(syscall_mem_alloc(0, (u_int) PAGE(i), PTE_V | PTE_R) == 0);
+                PAGE(i)[0] = pattern(i);
+                PAGE(i)[BY2PG / 4 - 1] = ~pattern(i);
+                if (i % 1024 == 0) {
+                        writef("%d ", i);
+                }
+        }
+        for (i = 0; i < NPAGE; i++) {
+                out += swapped((u_int) PAGE(i));
+        }
+        writef("\n%d of %d pages swapped out\n", out, NPAGE);
+        user_assert(out > 0);
+        for (i = 0; i < NPAGE; i++) {
+                user_assert(PAGE(i)[0] == pattern(i));
+                user_assert(PAGE(i)[BY2PG / 4 - 1] == ~pattern(i));
+        }
+        return;
+}
+
+// a forked child sees the swapped-out pages of its parent
+static void test_swap_fork(void) {
+        u_int i;
+        int r;
+
+        for (i = 0; i < NPAGE; i++) {
+                user_assert(syscall_mem_alloc(0, (u_int) PAGE(i), PTE_V | PTE_R) == 0);
+                PAGE(i)[0] = pattern(i);
+        }
+        if ((r = fork()) == 0) {
+                for (i = 0; i < NPAGE; i += 64) {
+                        user_assert(PAGE(i)[0] == pattern(i));
+                }
+                sem_post(done);
+                exit();
+        }
+        user_assert(r > 0);
+        sem_wait(done);
+        for (i = 0; i < NPAGE; i += 64) {
+                user_assert(PAGE(i)[0] == pattern(i));
+        }
+        return;
+}
+
+void umain(void) {
+        sem_t d;
+        TEST_INIT();
+        sem_init(&d, 1, 0);
+        done = &d;
+        TEST(swap_round_trip);
+        TEST(swap_fork);
+        TEST_OVER("testswap");
+}
@@ -0,0 +1,56 @@
+#include "lib.h"
+
+/* Scheduler accounting of every live env, read straight from UENVS.
+ * With -m the kernel also prints its object caches. */
+
+static char *status[] = { "free", "run", "block" };
+
+static void usage(void) {
+        fwritef(1, "usage: top [-h] [-m]\n");
+        exit();
+}
+
+static void top1(struct Env *e, int hist) {
+        int i;
+
+        fwritef(1, "%8x %8x %5s %3d %5d %8d %8d %8d %6d %6d\n",
+                        e->env_id, e->env_parent_id, status[e->env_status],
+                        e->env_level, e->env_pri, e->env_runs,
+                        e->env_ticks, e->env_wait_ticks,
+                        e->env_vswitch, e->env_ivswitch);
+        if (!hist) {
+                return;
+        }
+        fwritef(1, "         latency");
+        for (i = 0; i < ENV_LAT_BUCKETS; i++) {
+                fwritef(1, " <%d:%d", 1 << i, e->env_lat_hist[i]);
+        }
+        fwritef(1, "\n");
+}
+
+void umain(int argc, char **argv) {
+        int hist = 0, mem = 0;
+        struct Env *e;
+
+        ARGBEGIN{
+                default:
+                        usage();
+                case 'h':
+                        hist = 1;
+                        break;
+                case 'm':
+                        mem = 1;
+                        break;
+        }ARGEND
+
+        fwritef(1, "   envid   parent  stat lvl   pri     runs    ticks     wait   vsw   ivsw\n");
+        // the table grows a chunk at a time; stop at the first one not mapped
+        for (e = envs; e < envs + NENV && ((*vpt)[VPN((u_int)e)] & PTE_V); e++) {
+                if (e->env_status != ENV_FREE) {
+                        top1(e, hist);
+                }
+        }
+        if (mem) {
+                syscall_kmem_stat();
+        }
+}
@@ -7,6 +7,6 @@ void wait(u_int envid) {
         //writef("envid:%x  wait()~~~~~~~~~",envid);
         e = &envs[ENVX(envid)];
         while (e->env_id == envid && e->env_status != ENV_FREE)
-                syscall_yield();
+                syscall_yield_to(envid);
 }
 